@@ -0,0 +1,692 @@
+#include "piano_engine.h"
+#include "spsc_queue.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+#include <algorithm>
+#include <string>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <new>
+
+namespace {
+
+constexpr int    MIX_BLOCK_FRAMES        = 1024;    // process() renders in blocks of this size.
+constexpr int    COMMAND_QUEUE_SIZE      = 1024;
+constexpr int    DEFAULT_FREQUENCY       = 48000;
+constexpr int    DEFAULT_CHANNEL_NUM     = 2;
+constexpr int    DEFAULT_VOICE_NUM       = 32;
+constexpr int    DECODER_CHUNK_SIZE      = 1024;
+constexpr int    GATE_FADE_MILLISEC      = 5;       // shortest fade at the end of a gate, a hard cut clicks.
+constexpr double XRUN_INTERVAL_TOLERANCE = 1.5;     // a call later than 1.5 periods is an underrun.
+constexpr Uint64 EPOCH_NO_READER         = ~Uint64{ 0 };
+
+const char* SOUND_FILE_SUFFIX = ".Ogg";
+
+const PianoKeyInfo KEY_INFOS[PIANO_KEY_NUM] = {
+    { PIANO_KEY_WHITE, "1", "C3",  PIANO_WHITE_KEY_WIDTH * 0 },
+    { PIANO_KEY_WHITE, "3", "D3",  PIANO_WHITE_KEY_WIDTH * 1 },
+    { PIANO_KEY_WHITE, "5", "E3",  PIANO_WHITE_KEY_WIDTH * 2 },
+    { PIANO_KEY_WHITE, "6", "F3",  PIANO_WHITE_KEY_WIDTH * 3 },
+    { PIANO_KEY_WHITE, "8", "G3",  PIANO_WHITE_KEY_WIDTH * 4 },
+    { PIANO_KEY_WHITE, "0", "A3",  PIANO_WHITE_KEY_WIDTH * 5 },
+    { PIANO_KEY_WHITE, "W", "B3",  PIANO_WHITE_KEY_WIDTH * 6 },
+    { PIANO_KEY_WHITE, "E", "C4",  PIANO_WHITE_KEY_WIDTH * 7 },
+    { PIANO_KEY_WHITE, "T", "D4",  PIANO_WHITE_KEY_WIDTH * 8 },
+    { PIANO_KEY_WHITE, "U", "E4",  PIANO_WHITE_KEY_WIDTH * 9 },
+    { PIANO_KEY_WHITE, "I", "F4",  PIANO_WHITE_KEY_WIDTH * 10 },
+    { PIANO_KEY_WHITE, "P", "G4",  PIANO_WHITE_KEY_WIDTH * 11 },
+    { PIANO_KEY_WHITE, "S", "A4",  PIANO_WHITE_KEY_WIDTH * 12 },
+    { PIANO_KEY_WHITE, "F", "B4",  PIANO_WHITE_KEY_WIDTH * 13 },
+    { PIANO_KEY_WHITE, "G", "C5",  PIANO_WHITE_KEY_WIDTH * 14 },
+    { PIANO_KEY_WHITE, "J", "D5",  PIANO_WHITE_KEY_WIDTH * 15 },
+    { PIANO_KEY_WHITE, "L", "E5",  PIANO_WHITE_KEY_WIDTH * 16 },
+    { PIANO_KEY_WHITE, "Z", "F5",  PIANO_WHITE_KEY_WIDTH * 17 },
+    { PIANO_KEY_WHITE, "C", "G5",  PIANO_WHITE_KEY_WIDTH * 18 },
+    { PIANO_KEY_WHITE, "B", "A5",  PIANO_WHITE_KEY_WIDTH * 19 },
+    { PIANO_KEY_WHITE, "M", "B5",  PIANO_WHITE_KEY_WIDTH * 20 },
+    { PIANO_KEY_BLACK, "2", "Db3", PIANO_WHITE_KEY_WIDTH * 1 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "4", "Eb3", PIANO_WHITE_KEY_WIDTH * 2 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "7", "Gb3", PIANO_WHITE_KEY_WIDTH * 4 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "9", "Ab3", PIANO_WHITE_KEY_WIDTH * 5 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "Q", "Bb3", PIANO_WHITE_KEY_WIDTH * 6 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "R", "Db4", PIANO_WHITE_KEY_WIDTH * 8 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "Y", "Eb4", PIANO_WHITE_KEY_WIDTH * 9 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "O", "Gb4", PIANO_WHITE_KEY_WIDTH * 11 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "A", "Ab4", PIANO_WHITE_KEY_WIDTH * 12 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "D", "Bb4", PIANO_WHITE_KEY_WIDTH * 13 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "H", "Db5", PIANO_WHITE_KEY_WIDTH * 15 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "K", "Eb5", PIANO_WHITE_KEY_WIDTH * 16 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "X", "Gb5", PIANO_WHITE_KEY_WIDTH * 18 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "V", "Ab5", PIANO_WHITE_KEY_WIDTH * 19 - PIANO_BLACK_KEY_WIDTH / 2 },
+    { PIANO_KEY_BLACK, "N", "Bb5", PIANO_WHITE_KEY_WIDTH * 20 - PIANO_BLACK_KEY_WIDTH / 2 }
+};
+
+// immutable once published.
+struct Sample {
+    std::vector<Sint16> pcm;
+    int frameNum;
+};
+
+enum class CommandType {
+    NoteOn, NoteOff
+};
+
+struct Command {
+    CommandType type;
+    int key;
+};
+
+struct Voice {
+    const Sample* sample = nullptr;
+    int key = 0;
+    int bus = 0;
+    int pos = 0;
+    int delay = 0;            // frames of silence before the note starts.
+    int gateLeft = -1;        // frames until the fade out starts by itself, -1 without a gate.
+    int releaseLeft = -1;     // frames left of the fade out, -1 while the key is held.
+    int fadeFrames = 0;       // length of the fade out once started.
+    Uint64 startEpoch = 0;
+};
+
+struct RetiredSample {
+    Sample* sample;
+    Uint64 epoch;
+};
+
+void store_max(std::atomic<Uint64>& target, Uint64 value) noexcept {
+    if (value > target.load(std::memory_order_relaxed)) {
+        target.store(value, std::memory_order_relaxed);
+    }
+}
+
+}
+
+struct PianoEngine {
+    PianoEngineConfig config;
+    int releaseFrames = 0;
+    int gateFadeFrames = 0;
+
+    std::array<std::atomic<Sample*>, PIANO_KEY_NUM> samples{};
+    SpscQueue<Command, COMMAND_QUEUE_SIZE> commands;
+
+    // audio thread only.
+    std::vector<Voice> voices;
+    std::vector<int> mixBuffer;
+    Uint64 epoch = 0;
+    Uint64 lastBegin = 0;
+
+    // samples swapped out, freed once no voice started before the swap is left.
+    std::atomic<Uint64> publishedEpoch{ 0 };
+    std::atomic<Uint64> oldestReader{ EPOCH_NO_READER };
+    std::mutex retiredMutex;
+    std::vector<RetiredSample> retired;
+
+    double counterFrequency = static_cast<double>(SDL_GetPerformanceFrequency());
+    std::atomic<bool> restartTiming{ false };
+    std::atomic<Uint64> processCalls{ 0 };
+    std::atomic<Uint64> notesPlayed{ 0 };
+    std::atomic<Uint64> notesDropped{ 0 };
+    std::atomic<Uint64> voicesStolen{ 0 };
+    std::atomic<Uint64> underruns{ 0 };
+    std::atomic<Uint64> overloads{ 0 };
+    std::atomic<int> activeVoices{ 0 };
+    std::atomic<Uint64> maxInterval{ 0 };
+    std::atomic<Uint64> maxLoadPermille{ 0 };
+
+    ~PianoEngine() noexcept {
+        for (auto& sample : samples) {
+            delete sample.load();
+        }
+
+        for (auto const& r : retired) {
+            delete r.sample;
+        }
+    }
+};
+
+namespace {
+
+bool valid_key(int key) noexcept {
+    return key >= 0 && key < PIANO_KEY_NUM;
+}
+
+/*
+    SDL_mixer only decodes while it is open, and converts to the format it is open with.
+    a host that has it open with the engine format is used as is. without SDL audio at all, one
+    decoder device is opened on the dummy driver for the whole load call, so no sound card is touched.
+    a host running SDL audio on a real driver with SDL_mixer closed is refused, opening SDL_mixer
+    there would open its output device.
+*/
+class Decoder {
+    const PianoEngine* engine;
+    bool closeMixer = false;
+    bool quitAudio = false;
+    bool ready = false;
+
+    // the driver hint is only read by SDL_InitSubSystem(), it is put back right after.
+    static bool init_dummy_audio() noexcept {
+        const char* hint = SDL_GetHint(SDL_HINT_AUDIODRIVER);
+        std::string oldDriver = hint != nullptr ? hint : "";
+
+        SDL_SetHintWithPriority(SDL_HINT_AUDIODRIVER, "dummy", SDL_HINT_OVERRIDE);
+        int result = SDL_InitSubSystem(SDL_INIT_AUDIO);
+        SDL_ResetHint(SDL_HINT_AUDIODRIVER);
+
+        hint = SDL_GetHint(SDL_HINT_AUDIODRIVER);
+        if (!oldDriver.empty() && (hint == nullptr || oldDriver != hint)) {
+            SDL_SetHint(SDL_HINT_AUDIODRIVER, oldDriver.c_str());
+        }
+
+        return result == 0;
+    }
+public:
+    explicit Decoder(const PianoEngine* _engine) noexcept
+        : engine{ _engine }
+    {
+        int frequency, channels;
+        Uint16 format;
+
+        if (Mix_QuerySpec(&frequency, &format, &channels) == 0) {
+            if (SDL_WasInit(SDL_INIT_AUDIO)) {
+                const char* driver = SDL_GetCurrentAudioDriver();
+
+                if (driver == nullptr || std::strcmp(driver, "dummy") != 0) {
+                    SDL_SetError("SDL audio runs on the %s driver with SDL_mixer closed, open SDL_mixer with the engine format before loading samples",
+                        driver != nullptr ? driver : "(none)");
+                    return;
+                }
+            }
+            else if (init_dummy_audio()) {
+                quitAudio = true;
+            }
+            else {
+                return;
+            }
+
+            if (Mix_OpenAudio(engine->config.frequency, AUDIO_S16SYS, engine->config.channels, DECODER_CHUNK_SIZE) < 0) {
+                SDL_SetError("SDL_mixer could not open a decoder: %s", Mix_GetError());
+                return;
+            }
+
+            closeMixer = true;
+
+            if (Mix_QuerySpec(&frequency, &format, &channels) == 0) {
+                return;
+            }
+        }
+
+        if (frequency != engine->config.frequency || channels != engine->config.channels || format != AUDIO_S16SYS) {
+            SDL_SetError("SDL_mixer is open with %d Hz, %d channels, the engine needs %d Hz, %d channels, 16 bit",
+                frequency, channels, engine->config.frequency, engine->config.channels);
+            return;
+        }
+
+        ready = true;
+    }
+
+    ~Decoder() noexcept {
+        if (closeMixer) {
+            Mix_CloseAudio();
+        }
+
+        if (quitAudio) {
+            SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        }
+    }
+
+    Decoder(Decoder const&) = delete;
+    Decoder& operator=(Decoder const&) = delete;
+
+    bool is_ready() const noexcept {
+        return ready;
+    }
+
+    // returns nullptr on failure, SDL_GetError() tells why.
+    Sample* decode(const char* path) {
+        SDL_RWops *rw = SDL_RWFromFile(path, "rb");
+
+        // the 2nd parameter of the Mix_LoadWAV_RW() will free the rw automatically.
+        Mix_Chunk* chunk = rw != nullptr ? Mix_LoadWAV_RW(rw, 1) : nullptr;
+
+        if (chunk == nullptr) {
+            SDL_SetError("Can't load sound resource: %s, error: %s", path, rw != nullptr ? Mix_GetError() : SDL_GetError());
+            return nullptr;
+        }
+
+        auto samples = reinterpret_cast<const Sint16*>(chunk->abuf);
+        std::size_t sampleNum = chunk->alen / sizeof(Sint16);
+        Sample* sample = nullptr;
+
+        try {
+            sample = new Sample{ std::vector<Sint16>(samples, samples + sampleNum), static_cast<int>(sampleNum / engine->config.channels) };
+        }
+        catch (std::bad_alloc const&) {
+            SDL_OutOfMemory();
+        }
+
+        Mix_FreeChunk(chunk);
+        return sample;
+    }
+};
+
+// publishes a freshly decoded sample, the one it replaces is retired. false when fresh is nullptr.
+bool store_sample(PianoEngine* engine, int key, Sample* fresh) noexcept {
+    if (fresh == nullptr) {
+        return false;
+    }
+
+    /*
+        the swap and the epoch read below pair with the epoch store at the end of process() and the
+        sample read in start_voice(), each thread writes one then reads the other. acquire/release
+        lets both threads read the old values, the old sample would then be tagged with an epoch older
+        than a voice just started on it and freed under it. seq_cst on all four forbids that.
+    */
+    Sample* old = engine->samples[key].exchange(fresh, std::memory_order_seq_cst);
+
+    if (old != nullptr) {
+        std::lock_guard<std::mutex> lock{ engine->retiredMutex };
+
+        try {
+            engine->retired.push_back(RetiredSample{ old, engine->publishedEpoch.load(std::memory_order_seq_cst) });
+        }
+        catch (std::bad_alloc const&) {
+            // can't tell when it is safe to free, leak it rather than risk a voice reading freed memory.
+        }
+    }
+
+    piano_engine_collect(engine);
+    return true;
+}
+
+void start_voice(PianoEngine* engine, int key, int delay, int gate, int bus) noexcept {
+    // seq_cst, see store_sample().
+    const Sample* sample = engine->samples[key].load(std::memory_order_seq_cst);
+    if (sample == nullptr) {
+        engine->notesDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // take a free voice, or steal the one which has played the longest.
+    Voice* target = &(engine->voices[0]);
+    for (auto& voice : engine->voices) {
+        if (voice.sample == nullptr) {
+            target = &voice;
+            break;
+        }
+
+        if (voice.pos > target->pos) {
+            target = &voice;
+        }
+    }
+
+    if (target->sample != nullptr) {
+        engine->voicesStolen.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    target->sample = sample;
+    target->key = key;
+    target->bus = bus;
+    target->pos = 0;
+    target->delay = delay;
+    target->gateLeft = gate;
+    target->releaseLeft = -1;
+    target->fadeFrames = engine->gateFadeFrames;
+    target->startEpoch = engine->epoch;
+    engine->notesPlayed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void release_voices(PianoEngine* engine, int key) noexcept {
+    if (engine->releaseFrames == 0) {
+        return;
+    }
+
+    for (auto& voice : engine->voices) {
+        if (voice.sample != nullptr && voice.key == key && voice.releaseLeft < 0) {
+            voice.gateLeft = -1;
+            voice.releaseLeft = engine->releaseFrames;
+            voice.fadeFrames = engine->releaseFrames;
+        }
+    }
+}
+
+void render_voice(PianoEngine* engine, Voice& voice, int* mix, int frameNum) noexcept {
+    int channels = engine->config.channels;
+    int f = std::min(voice.delay, frameNum);
+    voice.delay -= f;
+
+    const Sint16* pcm = voice.sample->pcm.data();
+    int frameEnd = std::min(frameNum, f + voice.sample->frameNum - voice.pos);
+
+    if (voice.releaseLeft < 0) {
+        int heldEnd = frameEnd;
+
+        if (voice.gateLeft >= 0) {
+            heldEnd = std::min(frameEnd, f + voice.gateLeft);
+            voice.gateLeft -= heldEnd - f;
+        }
+
+        for (; f < heldEnd; ++f, ++voice.pos) {
+            for (int c = 0; c < channels; ++c) {
+                mix[f * channels + c] += pcm[voice.pos * channels + c];
+            }
+        }
+
+        if (voice.gateLeft == 0) {
+            voice.gateLeft = -1;
+            voice.releaseLeft = voice.fadeFrames;
+        }
+    }
+
+    if (voice.releaseLeft >= 0) {
+        for (; f < frameEnd && voice.releaseLeft > 0; ++f, ++voice.pos, --voice.releaseLeft) {
+            for (int c = 0; c < channels; ++c) {
+                // long fades overflow an int, 32767 * releaseLeft passes 2^31 after 65536 frames.
+                mix[f * channels + c] += static_cast<int>(static_cast<Sint64>(pcm[voice.pos * channels + c]) * voice.releaseLeft / voice.fadeFrames);
+            }
+        }
+    }
+
+    if (voice.pos >= voice.sample->frameNum || voice.releaseLeft == 0) {
+        voice.sample = nullptr;
+    }
+}
+
+// renders frameNum frames starting done frames into each bus buffer.
+void render_block(PianoEngine* engine, Sint16* const* buffers, int busNum, int done, int frameNum) noexcept {
+    int sampleNum = frameNum * engine->config.channels;
+    int busSize = MIX_BLOCK_FRAMES * engine->config.channels;
+    int* mix = engine->mixBuffer.data();
+
+    std::fill(mix, mix + busSize * busNum, 0);
+
+    for (auto& voice : engine->voices) {
+        if (voice.sample != nullptr) {
+            int bus = voice.bus < busNum ? voice.bus : 0;
+            render_voice(engine, voice, mix + bus * busSize, frameNum);
+        }
+    }
+
+    for (int bus = 0; bus < busNum; ++bus) {
+        Sint16* buffer = buffers[bus] + done * engine->config.channels;
+        const int* busMix = mix + bus * busSize;
+
+        for (int i = 0; i < sampleNum; ++i) {
+            buffer[i] = static_cast<Sint16>(std::clamp(busMix[i], -32768, 32767));
+        }
+    }
+}
+
+}
+
+extern "C" {
+
+const PianoKeyInfo* piano_key_info(int key) {
+    return valid_key(key) ? &(KEY_INFOS[key]) : nullptr;
+}
+
+int piano_key_from_keycode(Sint32 keycode) {
+    switch (keycode) {
+        case SDLK_1: return 0;
+        case SDLK_3: return 1;
+        case SDLK_5: return 2;
+        case SDLK_6: return 3;
+        case SDLK_8: return 4;
+        case SDLK_0: return 5;
+        case SDLK_w: return 6;
+        case SDLK_e: return 7;
+        case SDLK_t: return 8;
+        case SDLK_u: return 9;
+        case SDLK_i: return 10;
+        case SDLK_p: return 11;
+        case SDLK_s: return 12;
+        case SDLK_f: return 13;
+        case SDLK_g: return 14;
+        case SDLK_j: return 15;
+        case SDLK_l: return 16;
+        case SDLK_z: return 17;
+        case SDLK_c: return 18;
+        case SDLK_b: return 19;
+        case SDLK_m: return 20;
+        case SDLK_2: return 21;
+        case SDLK_4: return 22;
+        case SDLK_7: return 23;
+        case SDLK_9: return 24;
+        case SDLK_q: return 25;
+        case SDLK_r: return 26;
+        case SDLK_y: return 27;
+        case SDLK_o: return 28;
+        case SDLK_a: return 29;
+        case SDLK_d: return 30;
+        case SDLK_h: return 31;
+        case SDLK_k: return 32;
+        case SDLK_x: return 33;
+        case SDLK_v: return 34;
+        case SDLK_n: return 35;
+        default: return -1;
+    }
+}
+
+void piano_engine_default_config(PianoEngineConfig* config) {
+    config->frequency = DEFAULT_FREQUENCY;
+    config->channels = DEFAULT_CHANNEL_NUM;
+    config->voiceNum = DEFAULT_VOICE_NUM;
+    config->releaseMillisec = 0;
+}
+
+PianoEngine* piano_engine_create(const PianoEngineConfig* config) {
+    if (config->frequency <= 0 || config->channels <= 0 || config->voiceNum <= 0 || config->releaseMillisec < 0) {
+        SDL_SetError("invalid piano engine config.");
+        return nullptr;
+    }
+
+    PianoEngine* engine = new (std::nothrow) PianoEngine;
+    if (engine == nullptr) {
+        SDL_OutOfMemory();
+        return nullptr;
+    }
+
+    // everything process() touches is allocated here.
+    try {
+        engine->config = *config;
+        engine->releaseFrames = static_cast<int>(static_cast<Sint64>(config->frequency) * config->releaseMillisec / 1000);
+        engine->gateFadeFrames = std::max(engine->releaseFrames, std::max(config->frequency * GATE_FADE_MILLISEC / 1000, 1));
+        engine->voices.resize(config->voiceNum);
+        engine->mixBuffer.resize(static_cast<std::size_t>(MIX_BLOCK_FRAMES) * config->channels * PIANO_ENGINE_MAX_BUSES);
+    }
+    catch (std::bad_alloc const&) {
+        delete engine;
+        SDL_OutOfMemory();
+        return nullptr;
+    }
+
+    return engine;
+}
+
+void piano_engine_destroy(PianoEngine* engine) {
+    delete engine;
+}
+
+int piano_engine_load_sample(PianoEngine* engine, int key, const char* path) {
+    if (!valid_key(key)) {
+        SDL_SetError("no such key: %d", key);
+        return 0;
+    }
+
+    Decoder decoder{ engine };
+    return decoder.is_ready() && store_sample(engine, key, decoder.decode(path));
+}
+
+int piano_engine_load_samples(PianoEngine* engine, const char* directory) {
+    Decoder decoder{ engine };
+    if (!decoder.is_ready()) {
+        return 0;
+    }
+
+    for (int key = 0; key < PIANO_KEY_NUM; ++key) {
+        std::string path = std::string{ directory } + KEY_INFOS[key].toneName + SOUND_FILE_SUFFIX;
+
+        if (!store_sample(engine, key, decoder.decode(path.c_str()))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int piano_engine_sample_loaded(const PianoEngine* engine, int key) {
+    return valid_key(key) && engine->samples[key].load(std::memory_order_acquire) != nullptr;
+}
+
+void piano_engine_collect(PianoEngine* engine) {
+    std::lock_guard<std::mutex> lock{ engine->retiredMutex };
+
+    if (engine->retired.empty()) {
+        return;
+    }
+
+    // a voice started in the process() call running during the swap may hold the old sample,
+    // so wait until that call is over and every voice started up to it has finished.
+    Uint64 now = engine->publishedEpoch.load(std::memory_order_acquire);
+    Uint64 oldest = engine->oldestReader.load(std::memory_order_acquire);
+
+    auto it = std::remove_if(engine->retired.begin(), engine->retired.end(), [&](RetiredSample const& r) {
+        if (now > r.epoch && oldest > r.epoch) {
+            delete r.sample;
+            return true;
+        }
+
+        return false;
+    });
+
+    engine->retired.erase(it, engine->retired.end());
+}
+
+int piano_engine_note_on(PianoEngine* engine, int key) {
+    if (!valid_key(key) || !engine->commands.push(Command{ CommandType::NoteOn, key })) {
+        engine->notesDropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    return 1;
+}
+
+int piano_engine_note_off(PianoEngine* engine, int key) {
+    return valid_key(key) && engine->commands.push(Command{ CommandType::NoteOff, key });
+}
+
+int piano_engine_schedule_note(PianoEngine* engine, int key, int frameOffset) {
+    if (!valid_key(key) || frameOffset < 0) {
+        return 0;
+    }
+
+    start_voice(engine, key, frameOffset, -1, 0);
+    return 1;
+}
+
+int piano_engine_schedule_gated_note(PianoEngine* engine, int key, int frameOffset, int gateFrames) {
+    if (!valid_key(key) || frameOffset < 0 || gateFrames <= 0) {
+        return 0;
+    }
+
+    start_voice(engine, key, frameOffset, gateFrames, 0);
+    return 1;
+}
+
+int piano_engine_schedule_bus_note(PianoEngine* engine, int key, int frameOffset, int gateFrames, int bus) {
+    if (!valid_key(key) || frameOffset < 0 || gateFrames < 0 || bus < 0 || bus >= PIANO_ENGINE_MAX_BUSES) {
+        return 0;
+    }
+
+    start_voice(engine, key, frameOffset, gateFrames > 0 ? gateFrames : -1, bus);
+    return 1;
+}
+
+void piano_engine_process(PianoEngine* engine, Sint16* buffer, int frameNum) {
+    piano_engine_process_buses(engine, &buffer, 1, frameNum);
+}
+
+void piano_engine_process_buses(PianoEngine* engine, Sint16* const* buffers, int busNum, int frameNum) {
+    Uint64 begin = SDL_GetPerformanceCounter();
+    Uint64 period = static_cast<Uint64>(engine->counterFrequency * frameNum / engine->config.frequency);
+
+    if (engine->restartTiming.exchange(false, std::memory_order_relaxed)) {
+        engine->lastBegin = 0;
+    }
+
+    if (engine->lastBegin != 0) {
+        Uint64 interval = begin - engine->lastBegin;
+
+        if (interval > period * XRUN_INTERVAL_TOLERANCE) {
+            engine->underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        store_max(engine->maxInterval, interval);
+    }
+
+    engine->lastBegin = begin;
+
+    Command cmd;
+    while (engine->commands.pop(cmd)) {
+        if (cmd.type == CommandType::NoteOn) {
+            start_voice(engine, cmd.key, 0, -1, 0);
+        }
+        else {
+            release_voices(engine, cmd.key);
+        }
+    }
+
+    busNum = std::clamp(busNum, 1, static_cast<int>(PIANO_ENGINE_MAX_BUSES));
+
+    for (int done = 0; done < frameNum; done += MIX_BLOCK_FRAMES) {
+        render_block(engine, buffers, busNum, done, std::min(MIX_BLOCK_FRAMES, frameNum - done));
+    }
+
+    // tell the sample loaders which samples may still be read.
+    Uint64 oldest = EPOCH_NO_READER;
+    int active = 0;
+    for (auto const& voice : engine->voices) {
+        if (voice.sample != nullptr) {
+            oldest = std::min(oldest, voice.startEpoch);
+            ++active;
+        }
+    }
+
+    engine->oldestReader.store(oldest, std::memory_order_release);
+    engine->publishedEpoch.store(++engine->epoch, std::memory_order_seq_cst);    // see store_sample().
+    engine->activeVoices.store(active, std::memory_order_relaxed);
+
+    Uint64 used = SDL_GetPerformanceCounter() - begin;
+    if (used > period) {
+        engine->overloads.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (period > 0) {
+        store_max(engine->maxLoadPermille, used * 1000 / period);
+    }
+
+    engine->processCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void piano_engine_restart_timing(PianoEngine* engine) {
+    engine->restartTiming.store(true, std::memory_order_relaxed);
+}
+
+void piano_engine_get_stats(PianoEngine* engine, PianoEngineStats* stats, int resetPeaks) {
+    Uint64 interval = resetPeaks ? engine->maxInterval.exchange(0, std::memory_order_relaxed) : engine->maxInterval.load(std::memory_order_relaxed);
+    Uint64 load = resetPeaks ? engine->maxLoadPermille.exchange(0, std::memory_order_relaxed) : engine->maxLoadPermille.load(std::memory_order_relaxed);
+
+    stats->processCalls = engine->processCalls.load(std::memory_order_relaxed);
+    stats->notesPlayed = engine->notesPlayed.load(std::memory_order_relaxed);
+    stats->notesDropped = engine->notesDropped.load(std::memory_order_relaxed);
+    stats->voicesStolen = engine->voicesStolen.load(std::memory_order_relaxed);
+    stats->underruns = engine->underruns.load(std::memory_order_relaxed);
+    stats->overloads = engine->overloads.load(std::memory_order_relaxed);
+    stats->activeVoices = engine->activeVoices.load(std::memory_order_relaxed);
+    stats->maxIntervalMillisec = interval * 1000.0 / engine->counterFrequency;
+    stats->maxLoad = load / 1000.0;
+}
+
+}
@@ -0,0 +1,131 @@
+#ifndef PIANO_ENGINE_H
+#define PIANO_ENGINE_H
+
+/*
+    piano engine shared by the C and C++ frontends, and usable on its own from another audio host.
+    it owns the key table, the samples and the voices, and renders interleaved 16 bit audio.
+    nothing here needs a window, and piano_engine_process() neither allocates nor locks.
+*/
+
+#include <SDL2/SDL_stdinc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* piano keys' attributes, in window units. */
+enum {
+    PIANO_BLACK_KEY_WIDTH  = 40,
+    PIANO_BLACK_KEY_HEIGHT = 254,
+    PIANO_WHITE_KEY_WIDTH  = 56,
+    PIANO_WHITE_KEY_HEIGHT = 390
+};
+
+/* C3 -> B5 tones, white keys come first in the key table. */
+enum {
+    PIANO_BLACK_KEY_NUM = 15,
+    PIANO_WHITE_KEY_NUM = 21,
+    PIANO_KEY_NUM       = PIANO_BLACK_KEY_NUM + PIANO_WHITE_KEY_NUM
+};
+
+/* separately rendered outputs, see piano_engine_process_buses(). */
+enum {
+    PIANO_ENGINE_MAX_BUSES = 4
+};
+
+/* piano key only contains 2 types: black and white. */
+typedef enum PianoKeyType {
+    PIANO_KEY_BLACK,
+    PIANO_KEY_WHITE
+} PianoKeyType;
+
+typedef struct PianoKeyInfo {
+    PianoKeyType keyType;    /* black or white ? */
+    const char* keyName;     /* key name on the keyboard. */
+    const char* toneName;    /* tone name, also the sound file name. */
+    int initX;               /* x position, used to render. */
+} PianoKeyInfo;
+
+/* NULL when key is out of range. */
+const PianoKeyInfo* piano_key_info(int key);
+
+/* maps an SDL_Keycode to a key index, -1 when the keycode plays nothing. */
+int piano_key_from_keycode(Sint32 keycode);
+
+typedef struct PianoEngineConfig {
+    int frequency;           /* output sample rate. */
+    int channels;            /* interleaved output channels. */
+    int voiceNum;            /* notes sounding at once, the oldest voice is stolen beyond it. */
+    int releaseMillisec;     /* fade out after note off, 0 lets the sound ring out. */
+} PianoEngineConfig;
+
+typedef struct PianoEngineStats {
+    Uint64 processCalls;
+    Uint64 notesPlayed;
+    Uint64 notesDropped;     /* command queue full, or no sample loaded for the key. */
+    Uint64 voicesStolen;
+    Uint64 underruns;        /* process() called too late, the device starved. */
+    Uint64 overloads;        /* process() took longer than the audio it rendered. */
+    int activeVoices;
+    double maxIntervalMillisec;
+    double maxLoad;          /* process time / rendered time. */
+} PianoEngineStats;
+
+typedef struct PianoEngine PianoEngine;
+
+void piano_engine_default_config(PianoEngineConfig* config);
+
+/* returns NULL on failure, SDL_GetError() tells why. */
+PianoEngine* piano_engine_create(const PianoEngineConfig* config);
+void piano_engine_destroy(PianoEngine* engine);
+
+/*
+    sample loading, not real-time safe. the file is decoded by SDL_mixer, which must be open with the
+    engine's frequency and channels. with SDL audio not started at all, one temporary device on the
+    dummy driver is opened per call instead, with SDL audio running elsewhere the call fails.
+    a sample replacing a loaded one is swapped in atomically, notes already playing finish with the
+    old one, which is freed by a later load or piano_engine_collect() once no voice reads it anymore.
+    return 1 on success, 0 on failure.
+*/
+int piano_engine_load_sample(PianoEngine* engine, int key, const char* path);
+int piano_engine_load_samples(PianoEngine* engine, const char* directory);
+int piano_engine_sample_loaded(const PianoEngine* engine, int key);
+void piano_engine_collect(PianoEngine* engine);
+
+/* from one control thread, queued for the next process() call. return 0 when the note is dropped. */
+int piano_engine_note_on(PianoEngine* engine, int key);
+int piano_engine_note_off(PianoEngine* engine, int key);
+
+/* from the thread calling process() only, starts the note frameOffset frames into the next process() call. */
+int piano_engine_schedule_note(PianoEngine* engine, int key, int frameOffset);
+
+/* same, and the note fades out by itself gateFrames frames after it starts, e.g. for arpeggios. */
+int piano_engine_schedule_gated_note(PianoEngine* engine, int key, int frameOffset, int gateFrames);
+
+/*
+    same, on one of the PIANO_ENGINE_MAX_BUSES buses, gateFrames 0 lets the note ring out.
+    notes from the other functions play on bus 0.
+*/
+int piano_engine_schedule_bus_note(PianoEngine* engine, int key, int frameOffset, int gateFrames, int bus);
+
+/* real-time safe, overwrites frameNum frames of interleaved samples. */
+void piano_engine_process(PianoEngine* engine, Sint16* buffer, int frameNum);
+
+/*
+    same, renders bus i into buffers[i] for i < busNum, busNum from 1 to PIANO_ENGINE_MAX_BUSES, so a
+    host can treat some notes apart, e.g. record the live playing without the backing.
+    notes on the other buses go to buffers[0].
+*/
+void piano_engine_process_buses(PianoEngine* engine, Sint16* const* buffers, int busNum, int frameNum);
+
+/* the gap before the next process() call is not counted as an underrun, e.g. after reopening a device. */
+void piano_engine_restart_timing(PianoEngine* engine);
+
+/* counters are cumulative, the max values restart when resetPeaks is set. */
+void piano_engine_get_stats(PianoEngine* engine, PianoEngineStats* stats, int resetPeaks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,6 +3,7 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
+#include "piano_engine.h"
 
 #undef main
 
@@ -10,16 +11,12 @@
 #define FRAME_RATE    30
 #define FRAME_DELAY   (1000 / FRAME_RATE)
 
-/* piano keys' attributes. */
-#define BLACK_KEY_WIDTH  40
-#define BLACK_KEY_HEIGHT 254
-#define WHITE_KEY_WIDTH  56
-#define WHITE_KEY_HEIGHT 390
-
-/* C3 -> B5 tones. */
-#define BLACK_KEY_NUM   15
-#define WHITE_KEY_NUM   21
-#define PIANO_KEY_NUM   (BLACK_KEY_NUM + WHITE_KEY_NUM)
+/* piano keys' attributes, the key table itself lives in the engine. */
+#define BLACK_KEY_WIDTH  PIANO_BLACK_KEY_WIDTH
+#define BLACK_KEY_HEIGHT PIANO_BLACK_KEY_HEIGHT
+#define WHITE_KEY_WIDTH  PIANO_WHITE_KEY_WIDTH
+#define WHITE_KEY_HEIGHT PIANO_WHITE_KEY_HEIGHT
+#define WHITE_KEY_NUM    PIANO_WHITE_KEY_NUM
 
 /* window attributes. */
 #define WINDOW_TITLE    "Piano"
@@ -38,17 +35,10 @@
 #define KEY_NAME_DISTANCE   22
 #define TONE_NAME_DISTANCE  42
 
-/* piano key only contains 2 types: black and white. */
-typedef enum KeyType {
-	KT_BLACK,
-	KT_WHITE
-} KeyType;
-
 typedef struct PianoKey {
-	KeyType keyType;         /* black or white ? */
+	PianoKeyType keyType;    /* black or white ? */
 	const char* keyName;     /* key name on the keyboard. */
 	const char* toneName;    /* tone name. */
-	Mix_Chunk* chunk;        /* the sound to be played. */
 	int isPressed;           /* is this key pressed ? */
 	int initX;               /* x position, used to render. */
 } PianoKey;
@@ -62,6 +52,8 @@ static SDL_Window* window = NULL;
 static SDL_Renderer* renderer = NULL;
 static TTF_Font* font = NULL;
 static PianoKey* pianoKeys = NULL;
+static PianoEngine* engine = NULL;
+static int audioChannelNum = 0;
 static char soundPath[SOUND_PATH_MAX_LEN];
 
 int init_graphics(void) {
@@ -91,58 +83,25 @@ int init_graphics(void) {
 	return 1;
 }
 
-void init_pianoKey(PianoKey* pk, KeyType kt, const char* keyName, const char* toneName, int initX){
-	pk->keyType = kt;
-	pk->keyName = keyName;
-	pk->toneName = toneName;
-	pk->chunk = NULL;
-	pk->isPressed = 0;
-	pk->initX = initX;
-}
-
 int init_pianoKeys(void){
+	int i;
+	const PianoKeyInfo* info;
+
 	pianoKeys = (PianoKey*)malloc(PIANO_KEY_NUM * sizeof(PianoKey));
 	if (pianoKeys == NULL){
 		SDL_Log("out of memory.\n");
 		return 0;
 	}
 
-	init_pianoKey(&(pianoKeys[0]),  KT_WHITE, "1", "C3",  WHITE_KEY_WIDTH * 0);
-	init_pianoKey(&(pianoKeys[1]),  KT_WHITE, "3", "D3",  WHITE_KEY_WIDTH * 1);
-	init_pianoKey(&(pianoKeys[2]),  KT_WHITE, "5", "E3",  WHITE_KEY_WIDTH * 2);
-	init_pianoKey(&(pianoKeys[3]),  KT_WHITE, "6", "F3",  WHITE_KEY_WIDTH * 3);
-	init_pianoKey(&(pianoKeys[4]),  KT_WHITE, "8", "G3",  WHITE_KEY_WIDTH * 4);
-	init_pianoKey(&(pianoKeys[5]),  KT_WHITE, "0", "A3",  WHITE_KEY_WIDTH * 5);
-	init_pianoKey(&(pianoKeys[6]),  KT_WHITE, "W", "B3",  WHITE_KEY_WIDTH * 6);
-	init_pianoKey(&(pianoKeys[7]),  KT_WHITE, "E", "C4",  WHITE_KEY_WIDTH * 7);
-	init_pianoKey(&(pianoKeys[8]),  KT_WHITE, "T", "D4",  WHITE_KEY_WIDTH * 8);
-	init_pianoKey(&(pianoKeys[9]),  KT_WHITE, "U", "E4",  WHITE_KEY_WIDTH * 9);
-	init_pianoKey(&(pianoKeys[10]), KT_WHITE, "I", "F4",  WHITE_KEY_WIDTH * 10);
-	init_pianoKey(&(pianoKeys[11]), KT_WHITE, "P", "G4",  WHITE_KEY_WIDTH * 11);
-	init_pianoKey(&(pianoKeys[12]), KT_WHITE, "S", "A4",  WHITE_KEY_WIDTH * 12);
-	init_pianoKey(&(pianoKeys[13]), KT_WHITE, "F", "B4",  WHITE_KEY_WIDTH * 13);
-	init_pianoKey(&(pianoKeys[14]), KT_WHITE, "G", "C5",  WHITE_KEY_WIDTH * 14);
-	init_pianoKey(&(pianoKeys[15]), KT_WHITE, "J", "D5",  WHITE_KEY_WIDTH * 15);
-	init_pianoKey(&(pianoKeys[16]), KT_WHITE, "L", "E5",  WHITE_KEY_WIDTH * 16);
-	init_pianoKey(&(pianoKeys[17]), KT_WHITE, "Z", "F5",  WHITE_KEY_WIDTH * 17);
-	init_pianoKey(&(pianoKeys[18]), KT_WHITE, "C", "G5",  WHITE_KEY_WIDTH * 18);
-	init_pianoKey(&(pianoKeys[19]), KT_WHITE, "B", "A5",  WHITE_KEY_WIDTH * 19);
-	init_pianoKey(&(pianoKeys[20]), KT_WHITE, "M", "B5",  WHITE_KEY_WIDTH * 20);
-	init_pianoKey(&(pianoKeys[21]), KT_BLACK, "2", "Db3", WHITE_KEY_WIDTH * 1 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[22]), KT_BLACK, "4", "Eb3", WHITE_KEY_WIDTH * 2 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[23]), KT_BLACK, "7", "Gb3", WHITE_KEY_WIDTH * 4 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[24]), KT_BLACK, "9", "Ab3", WHITE_KEY_WIDTH * 5 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[25]), KT_BLACK, "Q", "Bb3", WHITE_KEY_WIDTH * 6 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[26]), KT_BLACK, "R", "Db4", WHITE_KEY_WIDTH * 8 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[27]), KT_BLACK, "Y", "Eb4", WHITE_KEY_WIDTH * 9 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[28]), KT_BLACK, "O", "Gb4", WHITE_KEY_WIDTH * 11 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[29]), KT_BLACK, "A", "Ab4", WHITE_KEY_WIDTH * 12 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[30]), KT_BLACK, "D", "Bb4", WHITE_KEY_WIDTH * 13 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[31]), KT_BLACK, "H", "Db5", WHITE_KEY_WIDTH * 15 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[32]), KT_BLACK, "K", "Eb5", WHITE_KEY_WIDTH * 16 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[33]), KT_BLACK, "X", "Gb5", WHITE_KEY_WIDTH * 18 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[34]), KT_BLACK, "V", "Ab5", WHITE_KEY_WIDTH * 19 - BLACK_KEY_WIDTH / 2);
-	init_pianoKey(&(pianoKeys[35]), KT_BLACK, "N", "Bb5", WHITE_KEY_WIDTH * 20 - BLACK_KEY_WIDTH / 2);
+	for (i = 0; i < PIANO_KEY_NUM; ++i){
+		info = piano_key_info(i);
+
+		pianoKeys[i].keyType = info->keyType;
+		pianoKeys[i].keyName = info->keyName;
+		pianoKeys[i].toneName = info->toneName;
+		pianoKeys[i].isPressed = 0;
+		pianoKeys[i].initX = info->initX;
+	}
 
 	return 1;
 }
@@ -162,12 +121,40 @@ int init_ttf(void) {
 	return 1;
 }
 
+/* SDL_mixer only drives the device, the engine renders everything. */
+void audio_hook(void* udata, Uint8* stream, int len) {
+	(void)udata;
+	piano_engine_process(engine, (Sint16*)stream, len / (audioChannelNum * (int)sizeof(Sint16)));
+}
+
 int init_audio(void) {
+	PianoEngineConfig config;
+	Uint16 format;
+
 	if (Mix_OpenAudio(DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, DEFAULT_CHANNEL_NUM, DEFAULT_CHUNK_SIZE) < 0) {
         	SDL_Log("SDL_mixer could not initialize! SDL_mixer Error: %s\n", Mix_GetError());
         	return 0;
     	}
 
+	piano_engine_default_config(&config);
+	if (Mix_QuerySpec(&config.frequency, &format, &config.channels) == 0) {
+		SDL_Log("Mix_QuerySpec() failed: %s\n", Mix_GetError());
+		return 0;
+	}
+
+	if (format != AUDIO_S16SYS) {
+		SDL_Log("audio output must be 16 bit, got format: %d\n", format);
+		return 0;
+	}
+
+	engine = piano_engine_create(&config);
+	if (engine == NULL) {
+		SDL_Log("piano_engine_create() failed: %s\n", SDL_GetError());
+		return 0;
+	}
+
+	audioChannelNum = config.channels;
+	Mix_HookMusic(audio_hook, NULL);
 	return 1;
 }
 
@@ -176,14 +163,9 @@ int init_resources(void){
 }
 
 void clean_resources(void){
-	int i;
-	for (i = 0; i < PIANO_KEY_NUM; ++i){
-		if (pianoKeys[i].chunk != NULL) {
-			Mix_FreeChunk(pianoKeys[i].chunk);
-		}
-	}
-
+	Mix_HookMusic(NULL, NULL);
 	Mix_CloseAudio();
+	piano_engine_destroy(engine);
 	free(pianoKeys);
 
 	if (font != NULL){
@@ -203,46 +185,8 @@ void clean_resources(void){
 	SDL_Quit();
 }
 
-PianoKey* get_piano_key_mapping(SDL_KeyCode key){
-	switch (key) {
-		case SDLK_1: return &(pianoKeys[0]);
-		case SDLK_3: return &(pianoKeys[1]);
-		case SDLK_5: return &(pianoKeys[2]);
-		case SDLK_6: return &(pianoKeys[3]);
-		case SDLK_8: return &(pianoKeys[4]);
-		case SDLK_0: return &(pianoKeys[5]);
-		case SDLK_w: return &(pianoKeys[6]);
-		case SDLK_e: return &(pianoKeys[7]);
-		case SDLK_t: return &(pianoKeys[8]);
-		case SDLK_u: return &(pianoKeys[9]);
-		case SDLK_i: return &(pianoKeys[10]);
-		case SDLK_p: return &(pianoKeys[11]);
-		case SDLK_s: return &(pianoKeys[12]);
-		case SDLK_f: return &(pianoKeys[13]);
-		case SDLK_g: return &(pianoKeys[14]);
-		case SDLK_j: return &(pianoKeys[15]);
-		case SDLK_l: return &(pianoKeys[16]);
-		case SDLK_z: return &(pianoKeys[17]);
-		case SDLK_c: return &(pianoKeys[18]);
-		case SDLK_b: return &(pianoKeys[19]);
-		case SDLK_m: return &(pianoKeys[20]);
-		case SDLK_2: return &(pianoKeys[21]);
-		case SDLK_4: return &(pianoKeys[22]);
-		case SDLK_7: return &(pianoKeys[23]);
-		case SDLK_9: return &(pianoKeys[24]);
-		case SDLK_q: return &(pianoKeys[25]);
-		case SDLK_r: return &(pianoKeys[26]);
-		case SDLK_y: return &(pianoKeys[27]);
-		case SDLK_o: return &(pianoKeys[28]);
-		case SDLK_a: return &(pianoKeys[29]);
-		case SDLK_d: return &(pianoKeys[30]);
-		case SDLK_h: return &(pianoKeys[31]);
-		case SDLK_k: return &(pianoKeys[32]);
-		case SDLK_x: return &(pianoKeys[33]);
-		case SDLK_v: return &(pianoKeys[34]);
-		case SDLK_n: return &(pianoKeys[35]);
-		default: return NULL;
-	}
+int get_piano_key_mapping(SDL_KeyCode key){
+	return piano_key_from_keycode(key);
 }
 
 void render_key_text(PianoKey* pk, SDL_Color textColor, int width, int height){
@@ -281,7 +225,7 @@ void render_key(PianoKey* pk){
 	rect.x = pk->initX;
 	rect.y = 0;
 
-	if (pk->keyType == KT_BLACK){
+	if (pk->keyType == PIANO_KEY_BLACK){
 		rect.w = BLACK_KEY_WIDTH;
 		rect.h = BLACK_KEY_HEIGHT;
 		textColor = COLOR_WHITE;
@@ -340,18 +284,11 @@ void render(void){
 	SDL_RenderPresent(renderer);
 }
 
-int load_sound(PianoKey* pk){
-	snprintf(soundPath, SOUND_PATH_MAX_LEN, "./resources/%s.Ogg", pk->toneName);
-
-	SDL_RWops *rw = SDL_RWFromFile(soundPath, "rb");
-	if (rw == NULL){
-		SDL_Log("SDL_RWFromFile() failed on: %s, error: %s\n", soundPath, SDL_GetError());
-		return 0;
-	}
+int load_sound(int key){
+	snprintf(soundPath, SOUND_PATH_MAX_LEN, "./resources/%s.Ogg", pianoKeys[key].toneName);
 
-	/* the 2nd parameter of the Mix_LoadWAV_RW() will free the rw automatically. */
-	if ((pk->chunk = Mix_LoadWAV_RW(rw, 1)) == NULL){
-		SDL_Log("Can't load sound resource: %s, error: %s\n", soundPath, Mix_GetError());
+	if (!piano_engine_load_sample(engine, key, soundPath)){
+		SDL_Log("Can't load sound resource: %s, error: %s\n", soundPath, SDL_GetError());
 		return 0;
 	}
 
@@ -359,7 +296,7 @@ int load_sound(PianoKey* pk){
 }
 
 int main(){
-	PianoKey* pk;
+	int key;
 	Uint32 startTime, endTime, frameTime;
 	int running = 1;
 	SDL_Event event;
@@ -375,24 +312,25 @@ int main(){
 			if (event.type == SDL_QUIT) {
 				running = 0;
 			} else if (event.type == SDL_KEYDOWN) {
-				pk = get_piano_key_mapping(event.key.keysym.sym);
+				key = get_piano_key_mapping(event.key.keysym.sym);
 
-				if (pk != NULL){
-					pk->isPressed = 1;
+				if (key >= 0){
+					pianoKeys[key].isPressed = 1;
 
-					if (pk->chunk == NULL){   /* lazy load sound. */
-						if (!load_sound(pk)){
+					if (!piano_engine_sample_loaded(engine, key)){   /* lazy load sound. */
+						if (!load_sound(key)){
 							goto finally;
 						}
 					}
 
-					Mix_PlayChannel(event.key.keysym.sym % DEFAULT_CHANNEL_NUM, pk->chunk, 0);
+					piano_engine_note_on(engine, key);
 				}
 			} else if (event.type == SDL_KEYUP) {
-				pk = get_piano_key_mapping(event.key.keysym.sym);
+				key = get_piano_key_mapping(event.key.keysym.sym);
 
-				if (pk != NULL){
-					pk->isPressed = 0;
+				if (key >= 0){
+					pianoKeys[key].isPressed = 0;
+					piano_engine_note_off(engine, key);
 				}
 			}
 		}
@@ -1,12 +1,32 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
+#include "piano_engine.h"
+#include "spsc_queue.h"
 #include <iostream>
 #include <algorithm>
 #include <exception>
 #include <string>
 #include <memory>
 #include <array>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <cstring>
+#include <cerrno>
+#include <random>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #undef main
 
@@ -16,26 +36,73 @@ using namespace std::string_literals;
 constexpr int FRAME_RATE = 60;
 constexpr int FRAME_DELAY_MILLISEC = 1000 / FRAME_RATE;
 
-// piano keys' attributes.
-constexpr int BLACK_KEY_WIDTH  = 40;
-constexpr int BLACK_KEY_HEIGHT = 254;
-constexpr int WHITE_KEY_WIDTH  = 56;
-constexpr int WHITE_KEY_HEIGHT = 390;
-
-// C3 -> B5 tones.
-constexpr int BLACK_KEY_NUM = 15;
-constexpr int WHITE_KEY_NUM = 21;
-constexpr int PIANO_KEY_NUM = BLACK_KEY_NUM + WHITE_KEY_NUM;
+// piano keys' attributes, the key table itself lives in the engine.
+constexpr int BLACK_KEY_WIDTH  = PIANO_BLACK_KEY_WIDTH;
+constexpr int BLACK_KEY_HEIGHT = PIANO_BLACK_KEY_HEIGHT;
+constexpr int WHITE_KEY_WIDTH  = PIANO_WHITE_KEY_WIDTH;
+constexpr int WHITE_KEY_HEIGHT = PIANO_WHITE_KEY_HEIGHT;
+constexpr int WHITE_KEY_NUM    = PIANO_WHITE_KEY_NUM;
 
 // window attributes.
 const std::string WINDOW_TITLE = "Piano";
 constexpr int WINDOW_HEIGHT = WHITE_KEY_HEIGHT;
 constexpr int WINDOW_WIDTH = WHITE_KEY_WIDTH * WHITE_KEY_NUM;
+constexpr int WINDOW_MIN_WIDTH  = WINDOW_WIDTH / 4;
+constexpr int WINDOW_MIN_HEIGHT = WINDOW_HEIGHT / 4;
+constexpr int RELAYOUT_DEBOUNCE_MILLISEC = 150;    // labels are rasterized again once resizing pauses this long.
+
+// mouse and touch.
+constexpr int    MAX_POINTERS       = 16;                 // fingers plus the mouse.
+constexpr int    POINTER_TABLE_SIZE = MAX_POINTERS * 2;   // power of 2.
+constexpr Sint64 MOUSE_POINTER_ID   = INT64_MIN;
 
 // sound configurations.
 constexpr int MIXER_DEFAULT_FREQUENCY    = 48000;
 constexpr int MIXER_DEFAULT_CHANNEL_NUM  = 8;
 constexpr int MIXER_DEFAULT_CHUNK_SIZE   = 2048;
+constexpr int ENGINE_DEFAULT_VOICE_NUM   = 32;
+
+// looper configurations, track storage is preallocated from these.
+constexpr int LOOPER_TRACK_NUM          = 4;
+constexpr int LOOPER_DEFAULT_BPM        = 120;
+constexpr int LOOPER_MIN_BPM            = 40;
+constexpr int LOOPER_MAX_BPM            = 300;
+constexpr int LOOPER_BEATS_PER_BAR      = 4;
+constexpr int LOOPER_DEFAULT_BAR_NUM    = 2;
+constexpr int LOOPER_MAX_BAR_NUM        = 8;
+constexpr int LOOPER_MAX_EVENTS         = 2048;
+constexpr int LOOPER_COMMAND_QUEUE_SIZE = 256;
+constexpr int LOOPER_ENGINE_BUS         = 1;       // looped notes render apart from the live ones.
+constexpr int METRONOME_CLICK_MILLISEC  = 30;
+
+// arpeggiator, steps are 16th notes at the looper tempo.
+constexpr int ARP_STEPS_PER_BEAT       = 4;
+constexpr int ARP_MAX_NOTES            = PIANO_KEY_NUM;
+constexpr int ARP_COMMAND_QUEUE_SIZE   = 256;
+constexpr int ARP_DEFAULT_GATE_PERCENT = 50;
+constexpr int ARP_MIN_SWING_PERCENT    = 50;      // straight.
+constexpr int ARP_MAX_SWING_PERCENT    = 75;      // 67 is close to a triplet shuffle.
+constexpr int ARP_PERCENT_STEP         = 5;
+
+// resource hot reload.
+constexpr int WATCHER_POLL_MILLISEC = 250;
+
+// adaptive buffer sizing, the engine counts the underruns and overloads.
+constexpr int    MIXER_MIN_CHUNK_SIZE        = 256;
+constexpr int    MIXER_MAX_CHUNK_SIZE        = 8192;
+constexpr int    ADAPT_WINDOW_MILLISEC       = 2000;
+constexpr int    ADAPT_SHRINK_WINDOWS        = 5;       // clean windows needed before shrinking the buffer.
+constexpr int    ADAPT_MAX_SHRINK_WINDOWS    = 80;
+
+// stress mode.
+constexpr int STRESS_DEFAULT_RATE       = 1000;     // notes per second.
+constexpr int STRESS_REPORT_MILLISEC    = 1000;
+
+// input replay and golden output.
+constexpr int GOLDEN_DEFAULT_SNAPSHOT_EVERY   = FRAME_RATE;    // frames between two checked images.
+constexpr int GOLDEN_DEFAULT_AUDIO_TOLERANCE  = 2;             // in 16 bit sample steps.
+constexpr int GOLDEN_DEFAULT_PIXEL_TOLERANCE  = 2;             // per color channel.
+constexpr int REPLAY_MAX_TAIL_MILLISEC        = 5000;          // rendered after the last event at most.
 
 const std::string SOUND_FILE_PATH = "./resources/";
 const std::string SOUND_FILE_SUFFIX = ".Ogg";
@@ -46,6 +113,8 @@ constexpr int DEFAULT_FONT_SIZE  = 15;
 constexpr int KEY_NAME_DISTANCE  = 22;
 constexpr int TONE_NAME_DISTANCE = 42;
 
+constexpr double PI = 3.14159265358979323846;
+
 // colors.
 const SDL_Color COLOR_WHITE = { 255, 255, 255, 255 };
 const SDL_Color COLOR_BLACK = {   0,   0,   0, 255 };
@@ -94,50 +163,63 @@ public:
     } 
 };
 
+// maps the key geometry, given in window units, to drawable pixels.
+struct Layout {
+    double scaleX = 1.0;
+    double scaleY = 1.0;
+    int width = WINDOW_WIDTH;           // drawable size.
+    int height = WINDOW_HEIGHT;
+    double pixelsPerPointX = 1.0;       // window coordinates to drawable pixels.
+    double pixelsPerPointY = 1.0;
+
+    int x(int unit) const noexcept {
+        return static_cast<int>(std::lround(unit * scaleX));
+    }
+
+    int y(int unit) const noexcept {
+        return static_cast<int>(std::lround(unit * scaleY));
+    }
+
+    // edges are scaled, not sizes, so neighbouring keys never leave a gap.
+    SDL_Rect rect(int unitX, int unitY, int unitW, int unitH) const noexcept {
+        return SDL_Rect{ x(unitX), y(unitY), x(unitX + unitW) - x(unitX), y(unitY + unitH) - y(unitY) };
+    }
+
+    int font_size() const noexcept {
+        return std::max(1, static_cast<int>(std::lround(DEFAULT_FONT_SIZE * std::min(scaleX, scaleY))));
+    }
+};
+
 class Key {
     KeyType type;
     std::string keyName;
     std::string toneName;
-    Mix_Chunk* chunk = nullptr;
-    bool pressed = false;
+    int holds = 0;                      // keyboard keys and pointers holding this key down.
     int initX;
 
-    void load_sound() {
-        std::string soundPath = SOUND_FILE_PATH + toneName + SOUND_FILE_SUFFIX;
+    // rasterized once per font size, see create_labels().
+    std::unique_ptr<TextResource> keyNameText;
+    std::unique_ptr<TextResource> toneNameText;
 
-        SDL_RWops *rw = SDL_RWFromFile(soundPath.c_str(), "rb");
-	    if (rw == nullptr) {
-		    throw std::runtime_error { "SDL_RWFromFile() failed on: "s + soundPath + ", error: "s + SDL_GetError() };
-	    }
-
-	    // the 2nd parameter of the Mix_LoadWAV_RW() will free the rw automatically.
-	    if ((chunk = Mix_LoadWAV_RW(rw, 1)) == nullptr){
-		    throw std::runtime_error { "Can't load sound resource: "s + soundPath + ", error: "s + Mix_GetError() };
-	    }
-    }
+    static void render_label(SDL_Renderer* renderer, TextResource& text, int centerX, int y) noexcept {
+        SDL_Surface* surface = text.get_surface();
+        SDL_Rect rect;
 
-    void render_text(SDL_Renderer* renderer, TTF_Font* font, SDL_Color const& color, int width, int height) noexcept {
-        SDL_Rect keyNameRect, toneNameRect;
-        TextResource keyNameText, toneNameText;
+        rect.x = centerX - surface->w / 2;
+        rect.y = y;
+        rect.w = surface->w;
+        rect.h = surface->h;
 
-        keyNameText.create_text(renderer, font, keyName, color);
-        toneNameText.create_text(renderer, font, toneName, color);
-        
-        SDL_Surface* keyNameSurface = keyNameText.get_surface();
-        SDL_Surface* toneNameSurface = toneNameText.get_surface();
+        SDL_RenderCopy(renderer, text.get_texture(), nullptr, &rect);
+    }
 
-        keyNameRect.x = initX + width / 2 - keyNameSurface->w / 2;
-        keyNameRect.y = height - KEY_NAME_DISTANCE;
-        keyNameRect.w = keyNameSurface->w;
-        keyNameRect.h = keyNameSurface->h;
-        
-        toneNameRect.x = initX + width / 2 - toneNameSurface->w / 2;
-        toneNameRect.y = height - TONE_NAME_DISTANCE;
-        toneNameRect.w = toneNameSurface->w;
-        toneNameRect.h = toneNameSurface->h;
+    void render_text(SDL_Renderer* renderer, Layout const& layout, SDL_Rect const& rect) noexcept {
+        if (keyNameText == nullptr || toneNameText == nullptr) {
+            return;
+        }
 
-        SDL_RenderCopy(renderer, keyNameText.get_texture(), nullptr, &keyNameRect);
-        SDL_RenderCopy(renderer, toneNameText.get_texture(), nullptr, &toneNameRect);
+        render_label(renderer, *keyNameText, rect.x + rect.w / 2, rect.y + rect.h - layout.y(KEY_NAME_DISTANCE));
+        render_label(renderer, *toneNameText, rect.x + rect.w / 2, rect.y + rect.h - layout.y(TONE_NAME_DISTANCE));
     }
 public:
     Key(){}
@@ -146,36 +228,59 @@ public:
         : type{ _type }, keyName{ _keyName }, toneName{ _toneName }, initX{ _initX }
     {}
 
-    ~Key() noexcept {
-        if (chunk != nullptr) {
-            Mix_FreeChunk(chunk);
+    void press() noexcept {
+        ++holds;
+    }
+
+    void release() noexcept {
+        if (holds > 0) {
+            --holds;
         }
     }
 
-    void set_pressed(bool isPressed) noexcept {
-        pressed = isPressed;
+    bool is_pressed() const noexcept {
+        return holds > 0;
+    }
+
+    KeyType get_type() const noexcept {
+        return type;
     }
 
-    void play_sound(int channel) {
-        if (chunk == nullptr) {
-            load_sound();
+    SDL_Rect get_rect(Layout const& layout) const noexcept {
+        if (type == KeyType::Black) {
+            return layout.rect(initX, 0, BLACK_KEY_WIDTH, BLACK_KEY_HEIGHT);
         }
 
-        Mix_PlayChannel(channel, chunk, 0);
+        return layout.rect(initX, 0, WHITE_KEY_WIDTH, WHITE_KEY_HEIGHT);
     }
 
-    void render(SDL_Renderer* renderer, TTF_Font* font) {
-        SDL_Rect rect;
-        SDL_Color textColor;
+    std::string const& get_tone_name() const noexcept {
+        return toneName;
+    }
+
+    // the label textures belong to the renderer, they must go before it does.
+    void free_labels() noexcept {
+        keyNameText.reset();
+        toneNameText.reset();
+    }
 
-        rect.x = initX;
-        rect.y = 0;
+    void create_labels(SDL_Renderer* renderer, TTF_Font* font) {
+        SDL_Color const& textColor = (type == KeyType::Black) ? COLOR_WHITE : COLOR_BLACK;
+        auto keyNameFresh = std::make_unique<TextResource>();
+        auto toneNameFresh = std::make_unique<TextResource>();
 
-        if (type == KeyType::Black){
-            rect.w = BLACK_KEY_WIDTH;
-            rect.h = BLACK_KEY_HEIGHT;
-            textColor = COLOR_WHITE;
+        keyNameFresh->create_text(renderer, font, keyName, textColor);
+        toneNameFresh->create_text(renderer, font, toneName, textColor);
 
+        keyNameText = std::move(keyNameFresh);
+        toneNameText = std::move(toneNameFresh);
+    }
+
+    void render(SDL_Renderer* renderer, Layout const& layout) {
+        SDL_Rect rect = get_rect(layout);
+        bool pressed = holds > 0;
+
+        if (type == KeyType::Black){
             if (pressed){
                 set_render_draw_color(renderer, COLOR_MIKU);
             }
@@ -184,10 +289,6 @@ public:
             }
         }
         else {
-            rect.w = WHITE_KEY_WIDTH;
-            rect.h = WHITE_KEY_HEIGHT;
-            textColor = COLOR_BLACK;
-            
             if (pressed){
                 set_render_draw_color(renderer, COLOR_MIKU);
             }
@@ -203,229 +304,2358 @@ public:
         set_render_draw_color(renderer, COLOR_BLACK);
         SDL_RenderDrawRect(renderer, &rect);
 
-        render_text(renderer, font, textColor, rect.w, rect.h);
+        render_text(renderer, layout, rect);
     }
 };
 
-class Piano {
-    SDL_Window* window = nullptr;
-    SDL_Renderer* renderer = nullptr;
-    TTF_Font* font = nullptr;
-    std::array<Key, PIANO_KEY_NUM> keys;
+// index of the key playing the sound file toneName, -1 when no key does.
+int find_key(std::string const& toneName) noexcept {
+    for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+        if (toneName == piano_key_info(i)->toneName) {
+            return i;
+        }
+    }
 
-    void init_graphics_ttf_mixer(){
-        if (SDL_Init(SDL_INIT_VIDEO) < 0){
-            throw std::runtime_error { "SDL_Init() failed: "s + SDL_GetError() };
+    return -1;
+}
+
+std::string sound_path(int key) {
+    return SOUND_FILE_PATH + piano_key_info(key)->toneName + SOUND_FILE_SUFFIX;
+}
+
+// watches the resources directory on a background thread and reloads the changed files.
+class ResourceWatcher {
+    PianoEngine* engine = nullptr;
+    std::thread thread;
+    std::mutex decoderMutex;
+    std::atomic<bool> stopping{ false };
+    std::atomic<bool> fontChanged{ false };
+
+    void handle_change(std::string const& fileName) {
+        if (SOUND_FILE_PATH + fileName == FONT_PATH) {
+            fontChanged.store(true);
+            return;
         }
 
-        if (TTF_Init() == -1){
-            throw std::runtime_error { "SDL_ttf could not initialize! SDL_ttf Error: "s + TTF_GetError() };
+        if (fileName.size() <= SOUND_FILE_SUFFIX.size() ||
+            fileName.compare(fileName.size() - SOUND_FILE_SUFFIX.size(), SOUND_FILE_SUFFIX.size(), SOUND_FILE_SUFFIX) != 0) {
+            return;
         }
 
-        if (Mix_OpenAudio(MIXER_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, MIXER_DEFAULT_CHANNEL_NUM, MIXER_DEFAULT_CHUNK_SIZE) < 0) {
-        	throw std::runtime_error { "SDL_mixer could not initialize! SDL_mixer Error: "s + Mix_GetError() };
-    	}
+        // sounds never played yet are left to the lazy load.
+        int key = find_key(fileName.substr(0, fileName.size() - SOUND_FILE_SUFFIX.size()));
+        if (key < 0 || !piano_engine_sample_loaded(engine, key)) {
+            return;
+        }
+
+        auto lock = lock_decoder();
+        if (piano_engine_load_sample(engine, key, sound_path(key).c_str())) {
+            SDL_Log("reloaded sound: %s\n", fileName.c_str());
+        }
+        else {
+            SDL_Log("%s, keep the old sound.\n", SDL_GetError());
+        }
     }
 
-    void init_resources() {
-        window = SDL_CreateWindow(WINDOW_TITLE.c_str(), 
-								SDL_WINDOWPOS_CENTERED, 
-								SDL_WINDOWPOS_CENTERED, 
-								WINDOW_WIDTH, 
-								WINDOW_HEIGHT, 
-								0);
-							
-	    if (window == nullptr){
-		    throw std::runtime_error { "create window failed: "s + SDL_GetError() };
-	    }
+#ifdef __linux__
+    void watch() {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            SDL_Log("inotify_init1() failed, hot reload disabled: %s\n", std::strerror(errno));
+            return;
+        }
 
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
-        if (renderer == nullptr){
-            throw std::runtime_error{ "create renderer failed: "s + SDL_GetError() };
+        if (inotify_add_watch(fd, SOUND_FILE_PATH.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            SDL_Log("inotify_add_watch() failed on: %s, hot reload disabled: %s\n", SOUND_FILE_PATH.c_str(), std::strerror(errno));
+            ::close(fd);
+            return;
         }
 
-        font = TTF_OpenFont(FONT_PATH.c_str(), DEFAULT_FONT_SIZE);
-    	if (font == nullptr) {
-        	throw std::runtime_error{ "Failed to load font! SDL_ttf Error: "s + TTF_GetError() };
-    	}
+        alignas(inotify_event) char buffer[4096];
+        std::vector<std::string> changed;
+
+        while (!stopping.load()) {
+            pollfd pfd{ fd, POLLIN, 0 };
+            if (poll(&pfd, 1, WATCHER_POLL_MILLISEC) <= 0) {
+                continue;
+            }
+
+            // editors save in bursts, handle every file once per wake up.
+            changed.clear();
+            ssize_t len;
+            while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + len; ) {
+                    auto event = reinterpret_cast<inotify_event*>(p);
+
+                    if (event->len > 0 && std::find(changed.begin(), changed.end(), event->name) == changed.end()) {
+                        changed.emplace_back(event->name);
+                    }
+
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+
+            for (auto const& fileName : changed) {
+                handle_change(fileName);
+            }
+        }
+
+        ::close(fd);
+    }
+#else
+    static time_t modified_time(std::string const& fileName) noexcept {
+        struct stat info;
+        return stat((SOUND_FILE_PATH + fileName).c_str(), &info) == 0 ? info.st_mtime : 0;
     }
 
-    void init_keys() noexcept {
-        keys[0]  = Key{ KeyType::White, "1", "C3",  WHITE_KEY_WIDTH * 0 };
-        keys[1]  = Key{ KeyType::White, "3", "D3",  WHITE_KEY_WIDTH * 1 };
-        keys[2]  = Key{ KeyType::White, "5", "E3",  WHITE_KEY_WIDTH * 2 };
-        keys[3]  = Key{ KeyType::White, "6", "F3",  WHITE_KEY_WIDTH * 3 };
-        keys[4]  = Key{ KeyType::White, "8", "G3",  WHITE_KEY_WIDTH * 4 };
-        keys[5]  = Key{ KeyType::White, "0", "A3",  WHITE_KEY_WIDTH * 5 };
-        keys[6]  = Key{ KeyType::White, "W", "B3",  WHITE_KEY_WIDTH * 6 };
-        keys[7]  = Key{ KeyType::White, "E", "C4",  WHITE_KEY_WIDTH * 7 };
-        keys[8]  = Key{ KeyType::White, "T", "D4",  WHITE_KEY_WIDTH * 8 };
-        keys[9]  = Key{ KeyType::White, "U", "E4",  WHITE_KEY_WIDTH * 9 };
-        keys[10] = Key{ KeyType::White, "I", "F4",  WHITE_KEY_WIDTH * 10 };
-        keys[11] = Key{ KeyType::White, "P", "G4",  WHITE_KEY_WIDTH * 11 };
-        keys[12] = Key{ KeyType::White, "S", "A4",  WHITE_KEY_WIDTH * 12 };
-        keys[13] = Key{ KeyType::White, "F", "B4",  WHITE_KEY_WIDTH * 13 };
-        keys[14] = Key{ KeyType::White, "G", "C5",  WHITE_KEY_WIDTH * 14 };
-        keys[15] = Key{ KeyType::White, "J", "D5",  WHITE_KEY_WIDTH * 15 };
-        keys[16] = Key{ KeyType::White, "L", "E5",  WHITE_KEY_WIDTH * 16 };
-        keys[17] = Key{ KeyType::White, "Z", "F5",  WHITE_KEY_WIDTH * 17 };
-        keys[18] = Key{ KeyType::White, "C", "G5",  WHITE_KEY_WIDTH * 18 };
-        keys[19] = Key{ KeyType::White, "B", "A5",  WHITE_KEY_WIDTH * 19 };
-        keys[20] = Key{ KeyType::White, "M", "B5",  WHITE_KEY_WIDTH * 20 };
-        keys[21] = Key{ KeyType::Black, "2", "Db3", WHITE_KEY_WIDTH * 1 - BLACK_KEY_WIDTH / 2 };
-        keys[22] = Key{ KeyType::Black, "4", "Eb3", WHITE_KEY_WIDTH * 2 - BLACK_KEY_WIDTH / 2 };
-        keys[23] = Key{ KeyType::Black, "7", "Gb3", WHITE_KEY_WIDTH * 4 - BLACK_KEY_WIDTH / 2 };
-        keys[24] = Key{ KeyType::Black, "9", "Ab3", WHITE_KEY_WIDTH * 5 - BLACK_KEY_WIDTH / 2 };
-        keys[25] = Key{ KeyType::Black, "Q", "Bb3", WHITE_KEY_WIDTH * 6 - BLACK_KEY_WIDTH / 2 };
-        keys[26] = Key{ KeyType::Black, "R", "Db4", WHITE_KEY_WIDTH * 8 - BLACK_KEY_WIDTH / 2 };
-        keys[27] = Key{ KeyType::Black, "Y", "Eb4", WHITE_KEY_WIDTH * 9 - BLACK_KEY_WIDTH / 2 };
-        keys[28] = Key{ KeyType::Black, "O", "Gb4", WHITE_KEY_WIDTH * 11 - BLACK_KEY_WIDTH / 2 };
-        keys[29] = Key{ KeyType::Black, "A", "Ab4", WHITE_KEY_WIDTH * 12 - BLACK_KEY_WIDTH / 2 };
-        keys[30] = Key{ KeyType::Black, "D", "Bb4", WHITE_KEY_WIDTH * 13 - BLACK_KEY_WIDTH / 2 };
-        keys[31] = Key{ KeyType::Black, "H", "Db5", WHITE_KEY_WIDTH * 15 - BLACK_KEY_WIDTH / 2 };
-        keys[32] = Key{ KeyType::Black, "K", "Eb5", WHITE_KEY_WIDTH * 16 - BLACK_KEY_WIDTH / 2 };
-        keys[33] = Key{ KeyType::Black, "X", "Gb5", WHITE_KEY_WIDTH * 18 - BLACK_KEY_WIDTH / 2 };
-        keys[34] = Key{ KeyType::Black, "V", "Ab5", WHITE_KEY_WIDTH * 19 - BLACK_KEY_WIDTH / 2 };
-        keys[35] = Key{ KeyType::Black, "N", "Bb5", WHITE_KEY_WIDTH * 20 - BLACK_KEY_WIDTH / 2 };
-    }
-
-    Key* get_key_mapping(SDL_Keycode key) {
-        switch (key) {
-            case SDLK_1: return &(keys[0]);
-            case SDLK_3: return &(keys[1]);
-            case SDLK_5: return &(keys[2]);
-            case SDLK_6: return &(keys[3]);
-            case SDLK_8: return &(keys[4]);
-            case SDLK_0: return &(keys[5]);
-            case SDLK_w: return &(keys[6]);
-            case SDLK_e: return &(keys[7]);
-            case SDLK_t: return &(keys[8]);
-            case SDLK_u: return &(keys[9]);
-            case SDLK_i: return &(keys[10]);
-            case SDLK_p: return &(keys[11]);
-            case SDLK_s: return &(keys[12]);
-            case SDLK_f: return &(keys[13]);
-            case SDLK_g: return &(keys[14]);
-            case SDLK_j: return &(keys[15]);
-            case SDLK_l: return &(keys[16]);
-            case SDLK_z: return &(keys[17]);
-            case SDLK_c: return &(keys[18]);
-            case SDLK_b: return &(keys[19]);
-            case SDLK_m: return &(keys[20]);
-            case SDLK_2: return &(keys[21]);
-            case SDLK_4: return &(keys[22]);
-            case SDLK_7: return &(keys[23]);
-            case SDLK_9: return &(keys[24]);
-            case SDLK_q: return &(keys[25]);
-            case SDLK_r: return &(keys[26]);
-            case SDLK_y: return &(keys[27]);
-            case SDLK_o: return &(keys[28]);
-            case SDLK_a: return &(keys[29]);
-            case SDLK_d: return &(keys[30]);
-            case SDLK_h: return &(keys[31]);
-            case SDLK_k: return &(keys[32]);
-            case SDLK_x: return &(keys[33]);
-            case SDLK_v: return &(keys[34]);
-            case SDLK_n: return &(keys[35]);
-            default: return nullptr;
+    // no inotify here, poll the modified time of the files instead.
+    void watch() {
+        std::vector<std::string> fileNames;
+        for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+            fileNames.push_back(piano_key_info(i)->toneName + SOUND_FILE_SUFFIX);
+        }
+        fileNames.push_back(FONT_PATH.substr(SOUND_FILE_PATH.size()));
+
+        std::vector<time_t> stamps;
+        for (auto const& fileName : fileNames) {
+            stamps.push_back(modified_time(fileName));
+        }
+
+        while (!stopping.load()) {
+            SDL_Delay(WATCHER_POLL_MILLISEC);
+
+            for (std::size_t i = 0; i < fileNames.size(); ++i) {
+                time_t stamp = modified_time(fileNames[i]);
+
+                if (stamp != stamps[i]) {
+                    stamps[i] = stamp;
+                    handle_change(fileNames[i]);
+                }
+            }
         }
     }
+#endif
+public:
+    ResourceWatcher(){}
 
-    void render() {
-        set_render_draw_color(renderer, COLOR_BLACK);
-        SDL_RenderClear(renderer);
+    ~ResourceWatcher() noexcept {
+        stop();
+    }
 
-        // render white keys.
-        for (int i = 0; i < WHITE_KEY_NUM; ++i) {
-            keys[i].render(renderer, font);
+    void start(PianoEngine* _engine) {
+        engine = _engine;
+        thread = std::thread{ &ResourceWatcher::watch, this };
+    }
+
+    void stop() noexcept {
+        if (thread.joinable()) {
+            stopping.store(true);
+            thread.join();
         }
+    }
 
-        // render lines.
-        set_render_draw_color(renderer, COLOR_BLACK);
-        for (int i = 0; i < WHITE_KEY_NUM; ++i){
-            SDL_RenderDrawLine(renderer, i * WHITE_KEY_WIDTH, 0, i * WHITE_KEY_WIDTH, WHITE_KEY_HEIGHT);
+    // the engine decodes with the open device's format, hold this while the device is reopened.
+    std::unique_lock<std::mutex> lock_decoder() {
+        return std::unique_lock<std::mutex>{ decoderMutex };
+    }
+
+    bool take_font_change() noexcept {
+        return fontChanged.exchange(false);
+    }
+};
+
+enum class LooperCommandType {
+    NoteOn, Record, ToggleMute, SetMetronome, SetPcmCapture, Clear
+};
+
+struct LooperCommand {
+    LooperCommandType type;
+    int value;                 // key index, track index or on/off, depends on the type.
+};
+
+enum class TrackState {
+    Empty, Armed, Recording, Playing
+};
+
+struct LooperEvent {
+    int frame;                 // offset from the loop start.
+    int key;
+    int gate;                  // frames the note sounds, 0 lets it ring out.
+};
+
+struct LooperTrack {
+    TrackState state = TrackState::Empty;
+    bool muted = false;
+    bool usePcm = false;       // play the captured output instead of the note events.
+    int eventNum = 0;
+    int nextEvent = 0;
+    std::vector<LooperEvent> events;
+    std::vector<Sint16> pcm;
+};
+
+struct ClickVoice {
+    const Sint16* samples = nullptr;
+    int frameNum = 0;
+    int pos = 0;
+};
+
+inline Sint16 clamp_sample(int sample) noexcept {
+    return static_cast<Sint16>(std::clamp(sample, -32768, 32767));
+}
+
+/*
+    loop station, runs in the audio callback around the engine.
+    schedule() hands the notes of the coming block to the engine before it renders, so they start
+    on their exact frame, on their own engine bus. then mix() captures the live bus and adds the
+    looped notes, the audio tracks and the click.
+    every member below the command queue belongs to the audio thread once open() returns,
+    the UI thread only talks to it through the queue and reads the published track states.
+*/
+class Looper {
+    int channelNum = 0;
+    int beatFrames = 0;
+    int barFrames = 0;
+    int loopFrames = 0;
+
+    // UI thread side.
+    bool metronome = false;
+    bool pcmCapture = false;
+    std::array<int, LOOPER_TRACK_NUM> reported{};
+    std::array<std::atomic<int>, LOOPER_TRACK_NUM> published{};
+
+    SpscQueue<LooperCommand, LOOPER_COMMAND_QUEUE_SIZE> commands;
+
+    // audio thread side.
+    bool running = false;
+    bool metronomeOn = false;
+    bool pcmCaptureOn = false;
+    int loopPos = 0;
+    int countIn = 0;           // frames left before the first loop start, it holds start_loop() off.
+    std::array<int, LOOPER_COMMAND_QUEUE_SIZE> playedKeys{};
+    int playedKeyNum = 0;
+    std::array<LooperTrack, LOOPER_TRACK_NUM> tracks;
+    ClickVoice click;
+    std::vector<Sint16> accentClick;
+    std::vector<Sint16> beatClick;
+
+    void make_click(std::vector<Sint16>& buffer, int frequency, double tone) {
+        int frameNum = frequency * METRONOME_CLICK_MILLISEC / 1000;
+        buffer.assign(frameNum * channelNum, 0);
+
+        for (int f = 0; f < frameNum; ++f) {
+            double envelope = 1.0 - static_cast<double>(f) / frameNum;
+            auto sample = static_cast<Sint16>(std::sin(2.0 * PI * tone * f / frequency) * envelope * 8000.0);
+
+            for (int c = 0; c < channelNum; ++c) {
+                buffer[f * channelNum + c] = sample;
+            }
         }
+    }
 
-        // render black keys.
-        for (int i = WHITE_KEY_NUM; i < PIANO_KEY_NUM; ++i){
-            keys[i].render(renderer, font);
+    void send(LooperCommandType type, int value) noexcept {
+        if (!commands.push(LooperCommand{ type, value })) {
+            SDL_Log("looper command queue is full, command dropped.\n");
         }
+    }
 
-        SDL_RenderPresent(renderer);
+    bool counting_in() const noexcept {
+        return std::any_of(tracks.begin(), tracks.end(), [](LooperTrack const& track) {
+            return track.state == TrackState::Armed || track.state == TrackState::Recording;
+        });
+    }
+
+    void record_note(int key) noexcept {
+        for (auto& track : tracks) {
+            if (track.state == TrackState::Recording && track.eventNum < LOOPER_MAX_EVENTS) {
+                track.events[track.eventNum++] = LooperEvent{ loopPos, key, 0 };
+            }
+        }
+    }
+
+    void arm_track() noexcept {
+        if (counting_in()) {
+            return;
+        }
+
+        for (auto& track : tracks) {
+            if (track.state == TrackState::Empty) {
+                track.state = TrackState::Armed;
+                track.eventNum = 0;
+
+                // give one bar of count-in when the transport starts, a one bar loop wraps to 0 right away.
+                if (!running) {
+                    running = true;
+                    loopPos = loopFrames - barFrames;
+                    countIn = barFrames;
+                }
+
+                return;
+            }
+        }
+    }
+
+    void clear_tracks() noexcept {
+        for (auto& track : tracks) {
+            track.state = TrackState::Empty;
+            track.muted = false;
+            track.eventNum = 0;
+        }
+
+        click.samples = nullptr;
+        running = metronomeOn;
+        loopPos = 0;
+        countIn = 0;
+    }
+
+    void apply(LooperCommand const& cmd) noexcept {
+        switch (cmd.type) {
+            case LooperCommandType::NoteOn:
+                if (playedKeyNum < LOOPER_COMMAND_QUEUE_SIZE) {
+                    playedKeys[playedKeyNum++] = cmd.value;
+                }
+                break;
+            case LooperCommandType::Record:
+                arm_track();
+                break;
+            case LooperCommandType::ToggleMute:
+                tracks[cmd.value].muted = !tracks[cmd.value].muted;
+                break;
+            case LooperCommandType::SetMetronome:
+                metronomeOn = cmd.value != 0;
+                if (metronomeOn && !running) {
+                    running = true;
+                    loopPos = 0;
+                }
+                break;
+            case LooperCommandType::SetPcmCapture:
+                pcmCaptureOn = cmd.value != 0;
+                break;
+            case LooperCommandType::Clear:
+                clear_tracks();
+                break;
+        }
+    }
+
+    void start_loop() noexcept {
+        for (auto& track : tracks) {
+            if (track.state == TrackState::Recording) {
+                track.state = TrackState::Playing;
+            }
+            else if (track.state == TrackState::Armed) {
+                track.state = TrackState::Recording;
+                track.usePcm = pcmCaptureOn;
+            }
+        }
+    }
+
+    // schedules the events in [from, from + frameNum) of the loop, offset frames into the block.
+    // loopStarts tells the span begins a new pass, the track recorded in the last pass plays in it.
+    void schedule_span(PianoEngine* engine, int from, int frameNum, int offset, bool loopStarts) noexcept {
+        for (auto& track : tracks) {
+            bool playing = track.state == TrackState::Playing || (loopStarts && track.state == TrackState::Recording);
+
+            if (!playing || track.usePcm) {
+                continue;
+            }
+
+            if (loopStarts) {
+                track.nextEvent = 0;
+            }
+
+            while (track.nextEvent < track.eventNum && track.events[track.nextEvent].frame < from + frameNum) {
+                LooperEvent const& event = track.events[track.nextEvent];
+
+                if (event.frame >= from && !track.muted) {
+                    piano_engine_schedule_bus_note(engine, event.key, offset + event.frame - from, event.gate, LOOPER_ENGINE_BUS);
+                }
+
+                ++track.nextEvent;
+            }
+        }
+    }
+
+    void mix_frame(Sint16* frame, const Sint16* loopFrame) noexcept {
+        int pcmOffset = loopPos * channelNum;
+
+        for (int c = 0; c < channelNum; ++c) {
+            int rendered = frame[c];
+            int mixed = rendered + loopFrame[c];
+
+            // the capture takes what is played live, never the looped notes or the audio tracks.
+            for (auto& track : tracks) {
+                if (!track.usePcm) {
+                    continue;
+                }
+
+                if (track.state == TrackState::Recording) {
+                    track.pcm[pcmOffset + c] = static_cast<Sint16>(rendered);
+                }
+                else if (track.state == TrackState::Playing && !track.muted) {
+                    mixed += track.pcm[pcmOffset + c];
+                }
+            }
+
+            if (click.samples != nullptr) {
+                mixed += click.samples[click.pos * channelNum + c];
+            }
+
+            frame[c] = clamp_sample(mixed);
+        }
+    }
+
+    void publish() noexcept {
+        for (int i = 0; i < LOOPER_TRACK_NUM; ++i) {
+            published[i].store(static_cast<int>(tracks[i].state) | (tracks[i].muted ? 0x10 : 0), std::memory_order_relaxed);
+        }
     }
 public:
-    Piano() {}
+    Looper(){}
+
+    // the audio output must be interleaved 16 bit samples.
+    void open(int frequency, int channels, int bpm, int barNum) {
+        channelNum = channels;
+        beatFrames = frequency * 60 / bpm;
+        barFrames  = beatFrames * LOOPER_BEATS_PER_BAR;
+        loopFrames = barFrames * barNum;
+
+        for (auto& track : tracks) {
+            track.events.resize(LOOPER_MAX_EVENTS);
+            track.pcm.resize(static_cast<std::size_t>(loopFrames) * channelNum);
+        }
 
-    ~Piano() noexcept {
-        if (font != nullptr) {
-            TTF_CloseFont(font);
+        make_click(accentClick, frequency, 1760.0);
+        make_click(beatClick, frequency, 880.0);
+    }
+
+    // called from the audio thread before the engine renders the block.
+    void schedule(PianoEngine* engine, int frameNum) noexcept {
+        // notes are recorded once the loop start below has been applied.
+        LooperCommand cmd;
+        playedKeyNum = 0;
+        while (commands.pop(cmd)) {
+            apply(cmd);
         }
 
-        if (renderer != nullptr) {
-		    SDL_DestroyRenderer(renderer);
-	    }
-	
-	    if (window != nullptr) {
-		    SDL_DestroyWindow(window);
-	    }
+        if (!running) {
+            return;
+        }
 
-        Mix_CloseAudio();
-        Mix_Quit();
-        TTF_Quit();
-        SDL_Quit();        
+        // a loop starting right at this block starts before anything is scheduled or recorded into it,
+        // so a note played on the downbeat goes to the track starting to record.
+        if (loopPos == 0 && countIn == 0) {
+            start_loop();
+        }
+
+        for (int i = 0; i < playedKeyNum; ++i) {
+            record_note(playedKeys[i]);
+        }
+
+        // at most one loop start falls in a block, 0 when it is the first frame.
+        int untilStart = (loopFrames - loopPos) % loopFrames;
+
+        if (untilStart > 0) {
+            schedule_span(engine, loopPos, std::min(frameNum, untilStart), 0, false);
+        }
+
+        if (frameNum > untilStart) {
+            schedule_span(engine, 0, frameNum - untilStart, untilStart, true);
+        }
     }
 
-    void start() {
-        init_graphics_ttf_mixer();
-        init_resources();
-        init_keys();
+    // called from the audio thread after the engine rendered the block, the live notes into stream
+    // and the looped ones into loopStream.
+    void mix(Sint16* stream, const Sint16* loopStream, int frameNum) noexcept {
+        if (running) {
+            for (int f = 0; f < frameNum; ++f) {
+                if (loopPos == 0 && f > 0 && countIn == 0) {
+                    start_loop();
+                }
+
+                if (loopPos % beatFrames == 0 && (metronomeOn || counting_in())) {
+                    auto const& clickSamples = (loopPos % barFrames == 0) ? accentClick : beatClick;
+                    click.samples = clickSamples.data();
+                    click.frameNum = static_cast<int>(clickSamples.size()) / channelNum;
+                    click.pos = 0;
+                }
+
+                mix_frame(stream + f * channelNum, loopStream + f * channelNum);
+
+                if (click.samples != nullptr && ++click.pos >= click.frameNum) {
+                    click.samples = nullptr;
+                }
+
+                loopPos = (loopPos + 1) % loopFrames;
+                countIn = std::max(countIn - 1, 0);
+            }
+        }
+        else {
+            // looped notes still ring out after the tracks are cleared.
+            for (int i = 0; i < frameNum * channelNum; ++i) {
+                stream[i] = clamp_sample(stream[i] + loopStream[i]);
+            }
+        }
 
-        Uint32 startTime, endTime, frameTime;
-        bool running = true;
-        SDL_Event event;
+        publish();
+    }
 
-        while (running) {
-		startTime = SDL_GetTicks();
+    // called from the audio thread between schedule() and mix(), -1 while the transport is stopped.
+    int beat_position() const noexcept {
+        return running ? loopPos % beatFrames : -1;
+    }
 
-		while (SDL_PollEvent(&event)) {
-			if (event.type == SDL_QUIT) {
-				running = false;
-			} else if (event.type == SDL_KEYDOWN) {
-                    		Key* key = get_key_mapping(event.key.keysym.sym);
-
-                    		if (key != nullptr) {
-                        		key->set_pressed(true);
-                        		key->play_sound(event.key.keysym.sym % MIXER_DEFAULT_CHANNEL_NUM);
-                    		}
-			} else if (event.type == SDL_KEYUP) {
-				Key* key = get_key_mapping(event.key.keysym.sym);
-
-                    		if (key != nullptr) {
-                        		key->set_pressed(false);
-                    		}
-			}
-		}
+    int beat_frames() const noexcept {
+        return beatFrames;
+    }
 
-		render();
+    // called from the audio thread between schedule() and mix(), records a note scheduled frameOffset
+    // frames into the block. a note past the loop end belongs to the next pass: the armed track
+    // starts recording there, the recording one stops.
+    void record_scheduled(int key, int frameOffset, int gateFrames) noexcept {
+        if (!running) {
+            return;
+        }
 
-            	endTime = SDL_GetTicks();
-            	frameTime = endTime - startTime;
+        int frame = loopPos + frameOffset;
+        TrackState recordingState = TrackState::Recording;
 
-            	if (frameTime < FRAME_DELAY_MILLISEC) {
-                	SDL_Delay(FRAME_DELAY_MILLISEC - frameTime);
-            	}
-	}
+        if (frame >= loopFrames) {
+            frame -= loopFrames;
+            recordingState = TrackState::Armed;
+        }
+
+        for (auto& track : tracks) {
+            if (track.state == recordingState && track.eventNum < LOOPER_MAX_EVENTS) {
+                track.events[track.eventNum++] = LooperEvent{ frame, key, gateFrames };
+            }
+        }
+    }
+
+    void note_on(int key) noexcept {
+        send(LooperCommandType::NoteOn, key);
+    }
+
+    void record() noexcept {
+        send(LooperCommandType::Record, 0);
+    }
+
+    void toggle_mute(int track) noexcept {
+        send(LooperCommandType::ToggleMute, track);
+    }
+
+    void toggle_metronome() noexcept {
+        metronome = !metronome;
+        send(LooperCommandType::SetMetronome, metronome ? 1 : 0);
+        SDL_Log("metronome: %s\n", metronome ? "on" : "off");
+    }
+
+    void toggle_pcm_capture() noexcept {
+        pcmCapture = !pcmCapture;
+        send(LooperCommandType::SetPcmCapture, pcmCapture ? 1 : 0);
+        SDL_Log("looper records %s\n", pcmCapture ? "rendered audio" : "note events");
+    }
+
+    void clear() noexcept {
+        send(LooperCommandType::Clear, 0);
+    }
+
+    // called from the UI thread once per frame, logs the track state changes.
+    void report_changes() noexcept {
+        static const char* STATE_NAMES[] = { "empty", "armed", "recording", "playing" };
+
+        for (int i = 0; i < LOOPER_TRACK_NUM; ++i) {
+            int state = published[i].load(std::memory_order_relaxed);
+
+            if (state != reported[i]) {
+                reported[i] = state;
+                SDL_Log("looper track %d: %s%s\n", i + 1, STATE_NAMES[state & 0x0F], (state & 0x10) ? " (muted)" : "");
+            }
+        }
+    }
+};
+
+enum class ArpMode {
+    Off, Chord, Up, Down, Random
+};
+
+struct ChordShape {
+    const char* name;
+    int noteNum;
+    std::array<int, 4> intervals;     // semitones from the pressed key.
+};
+
+const std::array<ChordShape, 4> CHORD_SHAPES = {{
+    { "single",  1, { 0 } },
+    { "major",   3, { 0, 4, 7 } },
+    { "minor",   3, { 0, 3, 7 } },
+    { "seventh", 4, { 0, 4, 7, 10 } }
+}};
+
+const std::array<const char*, 5> ARP_MODE_NAMES = { "off", "chord", "up", "down", "random" };
+
+enum class ArpCommandType {
+    KeyDown, KeyUp, SetMode, SetChord, SetGate, SetSwing
+};
+
+struct ArpCommand {
+    ArpCommandType type;
+    int value;                 // key index, mode, chord shape or percent, depends on the type.
+};
+
+/*
+    turns the held keys into chords or 16th note arpeggios at the looper tempo.
+    runs in the audio callback like the looper: the held notes are sorted into a pattern whenever
+    a key goes up or down, and every step due in a block is scheduled on its exact frame, gated,
+    with the odd 16ths pushed late by the swing. nothing is allocated after construction.
+*/
+class Arpeggiator {
+    // pitch order of the keys, the key table lists the white keys first.
+    std::array<int, PIANO_KEY_NUM> keyAtPitch{};
+    std::array<int, PIANO_KEY_NUM> pitchOfKey{};
+
+    // UI thread side.
+    ArpMode mode = ArpMode::Off;
+    int chord = 0;
+    int gatePercent = ARP_DEFAULT_GATE_PERCENT;
+    int swingPercent = ARP_MIN_SWING_PERCENT;
+    std::array<bool, PIANO_KEY_NUM> down{};
+
+    SpscQueue<ArpCommand, ARP_COMMAND_QUEUE_SIZE> commands;
+
+    // audio thread side.
+    ArpMode modeOn = ArpMode::Off;
+    int chordOn = 0;
+    int gateOn = ARP_DEFAULT_GATE_PERCENT;
+    int swingOn = ARP_MIN_SWING_PERCENT;
+    std::array<bool, PIANO_KEY_NUM> held{};
+    std::array<int, ARP_MAX_NOTES> pattern{};
+    int patternLength = 0;
+    int step = 0;              // next pattern index.
+    int sixteenth = 0;         // next step within the beat.
+    int untilStep = 0;         // frames from the block start to the next step.
+    std::minstd_rand rng{ 20240101 };
+
+    static int pitch_of(std::string const& toneName) noexcept {
+        static const char* NOTE_NAMES[] = { "C", "Db", "D", "Eb", "E", "F", "Gb", "G", "Ab", "A", "Bb", "B" };
+        std::string note = toneName.substr(0, toneName.size() - 1);
+        int octave = toneName.back() - '0';
+
+        for (int i = 0; i < 12; ++i) {
+            if (note == NOTE_NAMES[i]) {
+                return octave * 12 + i;
+            }
+        }
+
+        return -1;
+    }
+
+    void send(ArpCommandType type, int value) noexcept {
+        if (!commands.push(ArpCommand{ type, value })) {
+            SDL_Log("arpeggiator command queue is full, command dropped.\n");
+        }
+    }
+
+    // chord notes above the keyboard fold back an octave.
+    template <typename F>
+    void for_each_chord_note(int key, F&& f) const noexcept {
+        ChordShape const& shape = CHORD_SHAPES[chordOn];
+
+        for (int i = 0; i < shape.noteNum; ++i) {
+            int pitch = pitchOfKey[key] + shape.intervals[i];
+            f(keyAtPitch[pitch < PIANO_KEY_NUM ? pitch : pitch - 12]);
+        }
+    }
+
+    void build_pattern() noexcept {
+        std::array<bool, PIANO_KEY_NUM> notes{};
+
+        for (int key = 0; key < PIANO_KEY_NUM; ++key) {
+            if (held[key]) {
+                for_each_chord_note(key, [&](int note) { notes[pitchOfKey[note]] = true; });
+            }
+        }
+
+        bool wasEmpty = patternLength == 0;
+        patternLength = 0;
+
+        for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+            int pitch = (modeOn == ArpMode::Down) ? PIANO_KEY_NUM - 1 - i : i;
+
+            if (notes[pitch]) {
+                pattern[patternLength++] = keyAtPitch[pitch];
+            }
+        }
+
+        // the first key down restarts the pattern, more keys only extend it.
+        if (wasEmpty) {
+            step = 0;
+            sixteenth = 0;
+            untilStep = 0;
+        }
+    }
+
+    void apply(ArpCommand const& cmd, PianoEngine* engine, Looper& looper) noexcept {
+        switch (cmd.type) {
+            case ArpCommandType::KeyDown:
+                held[cmd.value] = true;
+
+                if (modeOn == ArpMode::Chord) {
+                    for_each_chord_note(cmd.value, [&](int note) {
+                        piano_engine_schedule_note(engine, note, 0);
+                        looper.record_scheduled(note, 0, 0);
+                    });
+                }
+                break;
+            case ArpCommandType::KeyUp:
+                held[cmd.value] = false;
+                break;
+            case ArpCommandType::SetMode:
+                // the UI side forgets its keys on every mode change, so no key up would come for these.
+                modeOn = static_cast<ArpMode>(cmd.value);
+                held.fill(false);
+                break;
+            case ArpCommandType::SetChord:
+                chordOn = cmd.value;
+                break;
+            case ArpCommandType::SetGate:
+                gateOn = cmd.value;
+                break;
+            case ArpCommandType::SetSwing:
+                swingOn = cmd.value;
+                break;
+        }
+
+        build_pattern();
+    }
+
+    // the even 16th of each pair starts on the grid, the odd one swingOn percent into the pair.
+    int step_start(int s, int beatFrames) const noexcept {
+        int pairFrames = beatFrames * 2 / ARP_STEPS_PER_BEAT;
+        return pairFrames * (s / 2) + ((s % 2 != 0) ? pairFrames * swingOn / 100 : 0);
+    }
+
+    int step_length(int s, int beatFrames) const noexcept {
+        int end = (s + 1 < ARP_STEPS_PER_BEAT) ? step_start(s + 1, beatFrames) : beatFrames;
+        return end - step_start(s, beatFrames);
+    }
+
+    // locks the step clock to the looper grid while the transport runs.
+    void sync(int beatPos, int beatFrames) noexcept {
+        sixteenth = 0;
+        while (sixteenth < ARP_STEPS_PER_BEAT && step_start(sixteenth, beatFrames) < beatPos) {
+            ++sixteenth;
+        }
+
+        if (sixteenth == ARP_STEPS_PER_BEAT) {
+            sixteenth = 0;
+            untilStep = beatFrames - beatPos;
+        }
+        else {
+            untilStep = step_start(sixteenth, beatFrames) - beatPos;
+        }
+    }
+
+    void play_step(PianoEngine* engine, Looper& looper, int offset, int length) noexcept {
+        int index = (modeOn == ArpMode::Random) ? std::uniform_int_distribution<int>{ 0, patternLength - 1 }(rng) : step % patternLength;
+        int key = pattern[index];
+        int gate = std::max(length * gateOn / 100, 1);
+
+        piano_engine_schedule_gated_note(engine, key, offset, gate);
+        looper.record_scheduled(key, offset, gate);
+        step = (step + 1) % patternLength;
+    }
+public:
+    Arpeggiator() {
+        for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+            pitchOfKey[i] = pitch_of(piano_key_info(i)->toneName) - pitch_of(piano_key_info(0)->toneName);
+            keyAtPitch[pitchOfKey[i]] = i;
+        }
+    }
+
+    // called from the audio thread after the looper scheduled the block, before the engine renders it.
+    void schedule(PianoEngine* engine, Looper& looper, int frameNum) noexcept {
+        ArpCommand cmd;
+        while (commands.pop(cmd)) {
+            apply(cmd, engine, looper);
+        }
+
+        if (modeOn == ArpMode::Off || modeOn == ArpMode::Chord || patternLength == 0) {
+            return;
+        }
+
+        int beatFrames = looper.beat_frames();
+        int beatPos = looper.beat_position();
+        if (beatPos >= 0) {
+            sync(beatPos, beatFrames);
+        }
+
+        int offset = untilStep;
+        while (offset < frameNum) {
+            int length = step_length(sixteenth, beatFrames);
+
+            play_step(engine, looper, offset, length);
+            offset += length;
+            sixteenth = (sixteenth + 1) % ARP_STEPS_PER_BEAT;
+        }
+
+        untilStep = offset - frameNum;
+    }
+
+    bool is_on() const noexcept {
+        return mode != ArpMode::Off;
+    }
+
+    // a key held by several fingers only counts once.
+    void key_down(int key) noexcept {
+        if (!down[key]) {
+            down[key] = true;
+            send(ArpCommandType::KeyDown, key);
+        }
+    }
+
+    void key_up(int key) noexcept {
+        if (down[key]) {
+            down[key] = false;
+            send(ArpCommandType::KeyUp, key);
+        }
+    }
+
+    void set_mode(ArpMode _mode) noexcept {
+        mode = _mode;
+        down.fill(false);
+        send(ArpCommandType::SetMode, static_cast<int>(mode));
+        SDL_Log("arpeggiator: %s\n", ARP_MODE_NAMES[static_cast<int>(mode)]);
+    }
+
+    void next_mode() noexcept {
+        set_mode(static_cast<ArpMode>((static_cast<int>(mode) + 1) % static_cast<int>(ARP_MODE_NAMES.size())));
+    }
+
+    void set_chord(int _chord) noexcept {
+        chord = _chord;
+        send(ArpCommandType::SetChord, chord);
+        SDL_Log("chord: %s\n", CHORD_SHAPES[chord].name);
+    }
+
+    void next_chord() noexcept {
+        set_chord((chord + 1) % static_cast<int>(CHORD_SHAPES.size()));
+    }
+
+    void set_gate(int percent) noexcept {
+        gatePercent = std::clamp(percent, ARP_PERCENT_STEP, 100);
+        send(ArpCommandType::SetGate, gatePercent);
+        SDL_Log("arpeggiator gate: %d%%\n", gatePercent);
+    }
+
+    void set_swing(int percent) noexcept {
+        swingPercent = std::clamp(percent, ARP_MIN_SWING_PERCENT, ARP_MAX_SWING_PERCENT);
+        send(ArpCommandType::SetSwing, swingPercent);
+        SDL_Log("arpeggiator swing: %d%%\n", swingPercent);
+    }
+
+    // called before the audio starts, applies the command line without logging.
+    void configure(ArpMode _mode, int _chord, int _gatePercent, int _swingPercent) noexcept {
+        mode = _mode;
+        chord = _chord;
+        gatePercent = std::clamp(_gatePercent, ARP_PERCENT_STEP, 100);
+        swingPercent = std::clamp(_swingPercent, ARP_MIN_SWING_PERCENT, ARP_MAX_SWING_PERCENT);
+
+        send(ArpCommandType::SetChord, chord);
+        send(ArpCommandType::SetGate, gatePercent);
+        send(ArpCommandType::SetSwing, swingPercent);
+        send(ArpCommandType::SetMode, static_cast<int>(mode));
+    }
+
+    int get_gate() const noexcept {
+        return gatePercent;
+    }
+
+    int get_swing() const noexcept {
+        return swingPercent;
+    }
+};
+
+void log_audio_stats(const char* prefix, PianoEngineStats const& stats, int bufferFrames) noexcept {
+    SDL_Log("%sbuffer %d frames, callbacks %llu, underruns %llu, overloads %llu, max interval %.2f ms, max load %.0f%%\n",
+        prefix,
+        bufferFrames,
+        static_cast<unsigned long long>(stats.processCalls),
+        static_cast<unsigned long long>(stats.underruns),
+        static_cast<unsigned long long>(stats.overloads),
+        stats.maxIntervalMillisec,
+        stats.maxLoad * 100.0);
+}
+
+// fires random notes and chords at a fixed rate, to find where the voice count and buffer size break.
+class StressGenerator {
+    int rate = STRESS_DEFAULT_RATE;
+    int chordSize = 1;
+    bool enabled = false;
+    double backlog = 0.0;
+    Uint32 lastTime = 0;
+    Uint32 reportTime = 0;
+    std::minstd_rand rng{ 20240101 };
+public:
+    StressGenerator(){}
+
+    void configure(int _rate, int _chordSize) noexcept {
+        rate = _rate;
+        chordSize = std::clamp(_chordSize, 1, static_cast<int>(PIANO_KEY_NUM));
+    }
+
+    bool is_enabled() const noexcept {
+        return enabled;
+    }
+
+    void set_enabled(bool on, int voiceNum, Uint32 now) noexcept {
+        enabled = on;
+        backlog = 0.0;
+        lastTime = reportTime = now;
+        SDL_Log("stress mode: %s, %d notes/s, chord size %d, voices %d\n", on ? "on" : "off", rate, chordSize, voiceNum);
+    }
+
+    // called once per frame, plays the notes due since the last frame. the samples must be loaded.
+    void step(PianoEngine* engine, int bufferFrames, Uint32 now) {
+        if (!enabled) {
+            return;
+        }
+        backlog += (now - lastTime) * rate / 1000.0;
+        lastTime = now;
+
+        std::uniform_int_distribution<int> pickKey{ 0, PIANO_KEY_NUM - 1 };
+        while (backlog >= chordSize) {
+            int root = pickKey(rng);
+
+            // a chord is every 4th key from the root, wrapped around the keyboard.
+            for (int i = 0; i < chordSize; ++i) {
+                piano_engine_note_on(engine, (root + i * 4) % PIANO_KEY_NUM);
+            }
+
+            backlog -= chordSize;
+        }
+
+        if (now - reportTime >= STRESS_REPORT_MILLISEC) {
+            reportTime = now;
+
+            PianoEngineStats stats;
+            piano_engine_get_stats(engine, &stats, 1);
+            SDL_Log("stress: played %llu, stolen %llu, dropped %llu, active voices %d\n",
+                static_cast<unsigned long long>(stats.notesPlayed),
+                static_cast<unsigned long long>(stats.voicesStolen),
+                static_cast<unsigned long long>(stats.notesDropped),
+                stats.activeVoices);
+            log_audio_stats("stress: ", stats, bufferFrames);
+        }
+    }
+};
+
+struct Options {
+    int chunkSize = MIXER_DEFAULT_CHUNK_SIZE;
+    int voices = ENGINE_DEFAULT_VOICE_NUM;
+    int bpm = LOOPER_DEFAULT_BPM;
+    int loopBars = LOOPER_DEFAULT_BAR_NUM;
+    bool adaptiveBuffer = false;
+    bool stress = false;
+    int stressRate = STRESS_DEFAULT_RATE;
+    int stressChord = 1;
+    ArpMode arpMode = ArpMode::Off;
+    int chord = 0;
+    int gate = ARP_DEFAULT_GATE_PERCENT;
+    int swing = ARP_MIN_SWING_PERCENT;
+    std::string record;
+    std::string replay;
+    std::string golden;
+    bool updateGolden = false;
+    int snapshotEvery = GOLDEN_DEFAULT_SNAPSHOT_EVERY;
+    int audioTolerance = GOLDEN_DEFAULT_AUDIO_TOLERANCE;
+    int pixelTolerance = GOLDEN_DEFAULT_PIXEL_TOLERANCE;
+};
+
+const std::string USAGE =
+    "usage: sdl2_piano [options]\n"
+    "  --chunk-size N      audio buffer size in frames, power of 2 (default 2048)\n"
+    "  --adaptive-buffer   grow or shrink the audio buffer to stay glitch-free, F10 toggles it\n"
+    "  --voices N          notes sounding at once, the oldest is cut beyond it (default 32)\n"
+    "  --bpm N             looper and arpeggiator tempo, 40 - 300 (default 120)\n"
+    "  --loop-bars N       looper length in bars of 4/4, 1 - 8 (default 2)\n"
+    "  --stress N          start in stress mode firing N notes per second, F11 toggles it\n"
+    "  --stress-chord N    notes per chord in stress mode (default 1)\n"
+    "  --arp MODE          off, chord, up, down or random (default off), F12 cycles it\n"
+    "  --chord SHAPE       single, major, minor or seventh (default single), Tab cycles it\n"
+    "  --gate N            arpeggio note length in percent of a step (default 50)\n"
+    "  --swing N           odd 16ths start N percent into their pair, 50 - 75 (default 50)\n"
+    "  --record FILE       record the input events to FILE\n"
+    "  --replay FILE       replay FILE headless on a virtual clock, as fast as possible\n"
+    "  --golden DIR        compare the replayed audio and frames with DIR/audio.wav and DIR/frame_N.bmp\n"
+    "  --update-golden     write the golden output to the --golden directory instead\n"
+    "  --snapshot-every N  frames between two checked images (default 60)\n"
+    "  --audio-tolerance N largest sample difference allowed (default 2)\n"
+    "  --pixel-tolerance N largest color channel difference allowed (default 2)\n";
+
+// adaptive sizing doubles and halves the buffer, so it must start on a power of 2 to stay on one.
+int round_chunk_size(int frames) noexcept {
+    int chunkSize = MIXER_MIN_CHUNK_SIZE;
+
+    while (chunkSize < MIXER_MAX_CHUNK_SIZE && chunkSize * 3 / 2 < frames) {
+        chunkSize *= 2;
+    }
+
+    return chunkSize;
+}
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+
+    auto int_arg = [&](int& i) {
+        if (i + 1 >= argc) {
+            throw std::runtime_error { "missing value for "s + argv[i] + "\n"s + USAGE };
+        }
+
+        try {
+            return std::stoi(argv[++i]);
+        }
+        catch (std::exception const&) {
+            throw std::runtime_error { "bad value for "s + argv[i - 1] + ": "s + argv[i] + "\n"s + USAGE };
+        }
+    };
+
+    auto string_arg = [&](int& i) {
+        if (i + 1 >= argc) {
+            throw std::runtime_error { "missing value for "s + argv[i] + "\n"s + USAGE };
+        }
+
+        return std::string{ argv[++i] };
+    };
+
+    auto name_arg = [&](int& i, auto const& names) {
+        if (i + 1 >= argc) {
+            throw std::runtime_error { "missing value for "s + argv[i] + "\n"s + USAGE };
+        }
+
+        for (std::size_t n = 0; n < names.size(); ++n) {
+            if (argv[i + 1] == std::string{ names[n] }) {
+                ++i;
+                return static_cast<int>(n);
+            }
+        }
+
+        throw std::runtime_error { "bad value for "s + argv[i] + ": "s + argv[i + 1] + "\n"s + USAGE };
+    };
+
+    std::array<const char*, CHORD_SHAPES.size()> chordNames;
+    for (std::size_t n = 0; n < CHORD_SHAPES.size(); ++n) {
+        chordNames[n] = CHORD_SHAPES[n].name;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--chunk-size") {
+            int frames = int_arg(i);
+            options.chunkSize = round_chunk_size(frames);
+
+            if (options.chunkSize != frames) {
+                SDL_Log("--chunk-size %d is not a power of 2 in %d - %d, using %d\n", frames, MIXER_MIN_CHUNK_SIZE, MIXER_MAX_CHUNK_SIZE, options.chunkSize);
+            }
+        }
+        else if (arg == "--adaptive-buffer") {
+            options.adaptiveBuffer = true;
+        }
+        else if (arg == "--voices") {
+            options.voices = std::max(int_arg(i), 1);
+        }
+        else if (arg == "--bpm") {
+            options.bpm = std::clamp(int_arg(i), LOOPER_MIN_BPM, LOOPER_MAX_BPM);
+        }
+        else if (arg == "--loop-bars") {
+            options.loopBars = std::clamp(int_arg(i), 1, LOOPER_MAX_BAR_NUM);
+        }
+        else if (arg == "--stress") {
+            options.stress = true;
+            options.stressRate = std::max(int_arg(i), 1);
+        }
+        else if (arg == "--stress-chord") {
+            options.stressChord = int_arg(i);
+        }
+        else if (arg == "--arp") {
+            options.arpMode = static_cast<ArpMode>(name_arg(i, ARP_MODE_NAMES));
+        }
+        else if (arg == "--chord") {
+            options.chord = name_arg(i, chordNames);
+        }
+        else if (arg == "--gate") {
+            options.gate = int_arg(i);
+        }
+        else if (arg == "--swing") {
+            options.swing = int_arg(i);
+        }
+        else if (arg == "--record") {
+            options.record = string_arg(i);
+        }
+        else if (arg == "--replay") {
+            options.replay = string_arg(i);
+        }
+        else if (arg == "--golden") {
+            options.golden = string_arg(i);
+        }
+        else if (arg == "--update-golden") {
+            options.updateGolden = true;
+        }
+        else if (arg == "--snapshot-every") {
+            options.snapshotEvery = std::max(int_arg(i), 1);
+        }
+        else if (arg == "--audio-tolerance") {
+            options.audioTolerance = std::max(int_arg(i), 0);
+        }
+        else if (arg == "--pixel-tolerance") {
+            options.pixelTolerance = std::max(int_arg(i), 0);
+        }
+        else {
+            throw std::runtime_error { "unknown option: "s + arg + "\n"s + USAGE };
+        }
+    }
+
+    if (!options.golden.empty() && options.replay.empty()) {
+        throw std::runtime_error { "--golden needs --replay\n"s + USAGE };
+    }
+
+    if (options.updateGolden && options.golden.empty()) {
+        throw std::runtime_error { "--update-golden needs --golden\n"s + USAGE };
+    }
+
+    return options;
+}
+
+/*
+    key lookup by drawable pixel column, rebuilt when the layout changes.
+    a point above the bottom of the black keys takes the black key of its column if there is one,
+    otherwise the white key, so a hit costs two array reads whatever the number of keys.
+*/
+class HitTable {
+    std::vector<Sint8> whiteKeys;
+    std::vector<Sint8> blackKeys;
+    int blackBottom = 0;
+    int whiteBottom = 0;
+public:
+    HitTable(){}
+
+    void build(std::array<Key, PIANO_KEY_NUM> const& keys, Layout const& layout) {
+        whiteKeys.assign(layout.width, -1);
+        blackKeys.assign(layout.width, -1);
+        blackBottom = layout.y(BLACK_KEY_HEIGHT);
+        whiteBottom = layout.y(WHITE_KEY_HEIGHT);
+
+        for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+            SDL_Rect rect = keys[i].get_rect(layout);
+            auto& column = (keys[i].get_type() == KeyType::Black) ? blackKeys : whiteKeys;
+
+            for (int x = std::max(rect.x, 0); x < std::min(rect.x + rect.w, layout.width); ++x) {
+                column[x] = static_cast<Sint8>(i);
+            }
+        }
+    }
+
+    // -1 when no key is there.
+    int key_at(int x, int y) const noexcept {
+        if (x < 0 || x >= static_cast<int>(whiteKeys.size()) || y < 0 || y >= whiteBottom) {
+            return -1;
+        }
+
+        if (y < blackBottom && blackKeys[x] >= 0) {
+            return blackKeys[x];
+        }
+
+        return whiteKeys[x];
+    }
+};
+
+// fixed size open addressing map from a pointer (finger or mouse) to the key it holds.
+class PointerTable {
+    static_assert((POINTER_TABLE_SIZE & (POINTER_TABLE_SIZE - 1)) == 0, "POINTER_TABLE_SIZE must be a power of 2.");
+
+    struct Slot {
+        Sint64 id;
+        int key;
+        bool used;
+    };
+
+    std::array<Slot, POINTER_TABLE_SIZE> slots{};
+    int count = 0;
+
+    static int home(Sint64 id) noexcept {
+        Uint64 hash = static_cast<Uint64>(id) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<int>(hash >> 32) & (POINTER_TABLE_SIZE - 1);
+    }
+
+    int index_of(Sint64 id) const noexcept {
+        for (int i = home(id); slots[i].used; i = (i + 1) & (POINTER_TABLE_SIZE - 1)) {
+            if (slots[i].id == id) {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+public:
+    PointerTable(){}
+
+    // the key held by the pointer, nullptr when the pointer is not down.
+    int* find(Sint64 id) noexcept {
+        int i = index_of(id);
+        return i < 0 ? nullptr : &(slots[i].key);
+    }
+
+    bool insert(Sint64 id, int key) noexcept {
+        if (count == MAX_POINTERS) {
+            return false;
+        }
+
+        int i = home(id);
+        while (slots[i].used) {
+            i = (i + 1) & (POINTER_TABLE_SIZE - 1);
+        }
+
+        slots[i] = Slot{ id, key, true };
+        ++count;
+        return true;
+    }
+
+    // backward shift deletion, keeps the probe chains intact without tombstones.
+    void erase(Sint64 id) noexcept {
+        int hole = index_of(id);
+        if (hole < 0) {
+            return;
+        }
+
+        slots[hole].used = false;
+        --count;
+
+        for (int i = (hole + 1) & (POINTER_TABLE_SIZE - 1); slots[i].used; i = (i + 1) & (POINTER_TABLE_SIZE - 1)) {
+            int h = home(slots[i].id);
+            bool stays = (hole <= i) ? (hole < h && h <= i) : (hole < h || h <= i);
+
+            if (!stays) {
+                slots[hole] = slots[i];
+                slots[i].used = false;
+                hole = i;
+            }
+        }
+    }
+};
+
+// wall clock, or a virtual one that only moves when the frame loop waits, for deterministic replays.
+class Clock {
+    bool isVirtual = false;
+    Uint32 now = 0;
+public:
+    Clock(){}
+
+    void make_virtual() noexcept {
+        isVirtual = true;
+        now = 0;
+    }
+
+    bool is_virtual() const noexcept {
+        return isVirtual;
+    }
+
+    Uint32 ticks() const noexcept {
+        return isVirtual ? now : SDL_GetTicks();
+    }
+
+    void delay(Uint32 millisec) noexcept {
+        if (isVirtual) {
+            now += millisec;
+        }
+        else {
+            SDL_Delay(millisec);
+        }
+    }
+};
+
+struct RecordedEvent {
+    Uint64 frame;              // frame loop iteration the event was handled in.
+    SDL_Event event;
+};
+
+/*
+    input recording, one event per line: the frame, the event type and the fields Piano reads.
+    events Piano ignores are not written, so a recording replays the same on any machine.
+*/
+class EventRecorder {
+    std::ofstream out;
+public:
+    EventRecorder(){}
+
+    void open(std::string const& path) {
+        out.open(path);
+        if (!out) {
+            throw std::runtime_error { "can't write the recording: "s + path };
+        }
+
+        // finger positions are floats, keep every digit.
+        out.precision(9);
+    }
+
+    void record(Uint64 frame, SDL_Event const& event) {
+        if (!out.is_open()) {
+            return;
+        }
+
+        switch (event.type) {
+            case SDL_QUIT:
+                out << frame << " " << event.type << "\n";
+                break;
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                    out << frame << " " << event.type << " " << static_cast<int>(event.window.event) << " " << event.window.data1 << " " << event.window.data2 << "\n";
+                }
+                break;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+                out << frame << " " << event.type << " " << event.key.keysym.sym << " " << static_cast<int>(event.key.repeat) << "\n";
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+            case SDL_MOUSEBUTTONUP:
+                out << frame << " " << event.type << " " << event.button.which << " " << static_cast<int>(event.button.button) << " " << event.button.x << " " << event.button.y << "\n";
+                break;
+            case SDL_MOUSEMOTION:
+                out << frame << " " << event.type << " " << event.motion.which << " " << event.motion.state << " " << event.motion.x << " " << event.motion.y << "\n";
+                break;
+            case SDL_FINGERDOWN:
+            case SDL_FINGERMOTION:
+            case SDL_FINGERUP:
+                out << frame << " " << event.type << " " << event.tfinger.fingerId << " " << event.tfinger.x << " " << event.tfinger.y << "\n";
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+// reads a recording back and hands out the events of one frame at a time.
+class EventReplay {
+    std::vector<RecordedEvent> events;
+    std::size_t next = 0;
+
+    static SDL_Event parse(std::istringstream& line) {
+        SDL_Event event;
+        int value1 = 0;
+
+        std::memset(&event, 0, sizeof(event));
+        line >> event.type;
+
+        switch (event.type) {
+            case SDL_QUIT:
+                break;
+            case SDL_WINDOWEVENT:
+                line >> value1 >> event.window.data1 >> event.window.data2;
+                event.window.event = static_cast<Uint8>(value1);
+                break;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+                line >> event.key.keysym.sym >> value1;
+                event.key.repeat = static_cast<Uint8>(value1);
+                event.key.state = (event.type == SDL_KEYDOWN) ? SDL_PRESSED : SDL_RELEASED;
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+            case SDL_MOUSEBUTTONUP:
+                line >> event.button.which >> value1 >> event.button.x >> event.button.y;
+                event.button.button = static_cast<Uint8>(value1);
+                break;
+            case SDL_MOUSEMOTION:
+                line >> event.motion.which >> event.motion.state >> event.motion.x >> event.motion.y;
+                break;
+            case SDL_FINGERDOWN:
+            case SDL_FINGERMOTION:
+            case SDL_FINGERUP:
+                line >> event.tfinger.fingerId >> event.tfinger.x >> event.tfinger.y;
+                break;
+            default:
+                line.setstate(std::ios::failbit);
+                break;
+        }
+
+        return event;
+    }
+public:
+    EventReplay(){}
+
+    void load(std::string const& path) {
+        std::ifstream in{ path };
+        if (!in) {
+            throw std::runtime_error { "can't read the recording: "s + path };
+        }
+
+        std::string text;
+        for (int lineNum = 1; std::getline(in, text); ++lineNum) {
+            std::istringstream line{ text };
+            RecordedEvent recorded;
+
+            line >> recorded.frame;
+            recorded.event = parse(line);
+
+            if (!line || (!events.empty() && recorded.frame < events.back().frame)) {
+                throw std::runtime_error { "bad recording: "s + path + ":"s + std::to_string(lineNum) };
+            }
+
+            events.push_back(recorded);
+        }
+    }
+
+    template <typename F>
+    void for_frame(Uint64 frame, F&& f) {
+        while (next < events.size() && events[next].frame <= frame) {
+            f(events[next++].event);
+        }
+    }
+
+    bool finished() const noexcept {
+        return next >= events.size();
+    }
+};
+
+/*
+    checks a replay against golden output, or writes it with --update-golden.
+    the audio is compared sample by sample as it is rendered, frames are snapshotted every
+    snapshotEvery frames with SDL_RenderReadPixels() and compared channel by channel.
+*/
+class GoldenOutput {
+    std::string directory;
+    bool update = false;
+    int audioTolerance = 0;
+    int pixelTolerance = 0;
+    int snapshotEvery = 1;
+
+    int channelNum = 0;
+    SDL_RWops* wavOut = nullptr;
+    Uint32 wavBytes = 0;
+    Uint8* golden = nullptr;
+    Uint32 goldenLen = 0;
+    std::size_t renderedSamples = 0;
+    int maxAudioDiff = 0;
+    int failures = 0;
+
+    std::string audio_path() const {
+        return directory + "/audio.wav";
+    }
+
+    std::string frame_path(Uint64 frame) const {
+        return directory + "/frame_" + std::to_string(frame) + ".bmp";
+    }
+
+    // 16 bit PCM, the sizes are filled in by close_wav().
+    void write_wav_header(int frequency) noexcept {
+        SDL_RWwrite(wavOut, "RIFF", 1, 4);
+        SDL_WriteLE32(wavOut, 0);
+        SDL_RWwrite(wavOut, "WAVEfmt ", 1, 8);
+        SDL_WriteLE32(wavOut, 16);
+        SDL_WriteLE16(wavOut, 1);
+        SDL_WriteLE16(wavOut, static_cast<Uint16>(channelNum));
+        SDL_WriteLE32(wavOut, static_cast<Uint32>(frequency));
+        SDL_WriteLE32(wavOut, static_cast<Uint32>(frequency * channelNum * 2));
+        SDL_WriteLE16(wavOut, static_cast<Uint16>(channelNum * 2));
+        SDL_WriteLE16(wavOut, 16);
+        SDL_RWwrite(wavOut, "data", 1, 4);
+        SDL_WriteLE32(wavOut, 0);
+    }
+
+    void close_wav() noexcept {
+        SDL_RWseek(wavOut, 4, RW_SEEK_SET);
+        SDL_WriteLE32(wavOut, 36 + wavBytes);
+        SDL_RWseek(wavOut, 40, RW_SEEK_SET);
+        SDL_WriteLE32(wavOut, wavBytes);
+        SDL_RWclose(wavOut);
+        wavOut = nullptr;
+    }
+
+    void fail(std::string const& message) {
+        ++failures;
+        SDL_Log("golden mismatch: %s\n", message.c_str());
+    }
+
+    void compare_frame(SDL_Surface* rendered, Uint64 frame) {
+        SDL_Surface* loaded = SDL_LoadBMP(frame_path(frame).c_str());
+        if (loaded == nullptr) {
+            fail("no golden frame " + std::to_string(frame) + ": " + SDL_GetError());
+            return;
+        }
+
+        SDL_Surface* expected = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+        SDL_FreeSurface(loaded);
+
+        if (expected == nullptr || expected->w != rendered->w || expected->h != rendered->h) {
+            fail("frame " + std::to_string(frame) + " size differs");
+        }
+        else {
+            int mismatched = 0;
+
+            for (int y = 0; y < rendered->h; ++y) {
+                auto got = reinterpret_cast<const Uint8*>(rendered->pixels) + y * rendered->pitch;
+                auto want = reinterpret_cast<const Uint8*>(expected->pixels) + y * expected->pitch;
+
+                for (int x = 0; x < rendered->w * 4; x += 4) {
+                    // alpha is left out, BMP files don't keep it.
+                    for (int c = 0; c < 3; ++c) {
+                        if (std::abs(got[x + c] - want[x + c]) > pixelTolerance) {
+                            ++mismatched;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (mismatched > 0) {
+                fail("frame " + std::to_string(frame) + ": " + std::to_string(mismatched) + " pixels differ");
+            }
+        }
+
+        SDL_FreeSurface(expected);
+    }
+public:
+    GoldenOutput(){}
+
+    ~GoldenOutput() noexcept {
+        if (wavOut != nullptr) {
+            SDL_RWclose(wavOut);
+        }
+
+        SDL_FreeWAV(golden);
+    }
+
+    bool is_open() const noexcept {
+        return !directory.empty();
+    }
+
+    void open(Options const& options, int frequency, int channels) {
+        directory = options.golden;
+        update = options.updateGolden;
+        audioTolerance = options.audioTolerance;
+        pixelTolerance = options.pixelTolerance;
+        snapshotEvery = options.snapshotEvery;
+        channelNum = channels;
+
+        if (update) {
+            wavOut = SDL_RWFromFile(audio_path().c_str(), "wb");
+            if (wavOut == nullptr) {
+                throw std::runtime_error { "can't write the golden audio: "s + SDL_GetError() };
+            }
+
+            write_wav_header(frequency);
+            return;
+        }
+
+        SDL_AudioSpec spec;
+        if (SDL_LoadWAV(audio_path().c_str(), &spec, &golden, &goldenLen) == nullptr) {
+            throw std::runtime_error { "can't read the golden audio: "s + SDL_GetError() };
+        }
+
+        if (spec.format != AUDIO_S16LSB || spec.freq != frequency || spec.channels != channels) {
+            throw std::runtime_error { "the golden audio was recorded with another audio format." };
+        }
+    }
+
+    // called with every block the replay renders.
+    void add_audio(const Sint16* samples, int sampleNum) {
+        if (update) {
+            for (int i = 0; i < sampleNum; ++i) {
+                SDL_WriteLE16(wavOut, static_cast<Uint16>(samples[i]));
+            }
+
+            wavBytes += static_cast<Uint32>(sampleNum * 2);
+            return;
+        }
+
+        auto goldenSamples = reinterpret_cast<const Uint16*>(golden);
+        std::size_t goldenNum = goldenLen / 2;
+
+        for (int i = 0; i < sampleNum && renderedSamples + i < goldenNum; ++i) {
+            auto want = static_cast<Sint16>(SDL_SwapLE16(goldenSamples[renderedSamples + i]));
+            maxAudioDiff = std::max(maxAudioDiff, std::abs(samples[i] - want));
+        }
+
+        renderedSamples += sampleNum;
+    }
+
+    // called after drawing a frame and before presenting it.
+    void frame_rendered(SDL_Renderer* renderer, Uint64 frame) {
+        if (frame % snapshotEvery != 0) {
+            return;
+        }
+
+        int width, height;
+        if (SDL_GetRendererOutputSize(renderer, &width, &height) < 0) {
+            throw std::runtime_error { "SDL_GetRendererOutputSize() failed: "s + SDL_GetError() };
+        }
+
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (surface == nullptr) {
+            throw std::runtime_error { "SDL_CreateRGBSurfaceWithFormat() failed: "s + SDL_GetError() };
+        }
+
+        if (SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888, surface->pixels, surface->pitch) < 0) {
+            SDL_FreeSurface(surface);
+            throw std::runtime_error { "SDL_RenderReadPixels() failed: "s + SDL_GetError() };
+        }
+
+        if (update) {
+            if (SDL_SaveBMP(surface, frame_path(frame).c_str()) < 0) {
+                SDL_Log("can't write the golden frame %llu: %s\n", static_cast<unsigned long long>(frame), SDL_GetError());
+                ++failures;
+            }
+        }
+        else {
+            compare_frame(surface, frame);
+        }
+
+        SDL_FreeSurface(surface);
+    }
+
+    // returns true when everything matched, or the golden output was written.
+    bool finish() {
+        if (update) {
+            close_wav();
+            SDL_Log("golden output written to %s\n", directory.c_str());
+            return failures == 0;
+        }
+
+        if (renderedSamples != goldenLen / 2) {
+            fail("audio length " + std::to_string(renderedSamples / channelNum) + " frames, golden " + std::to_string(goldenLen / 2 / channelNum));
+        }
+
+        if (maxAudioDiff > audioTolerance) {
+            fail("audio differs by up to " + std::to_string(maxAudioDiff) + ", tolerance " + std::to_string(audioTolerance));
+        }
+
+        SDL_Log("golden check: %s, max audio difference %d\n", failures == 0 ? "passed" : "FAILED", maxAudioDiff);
+        return failures == 0;
+    }
+};
+
+class Piano {
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    TTF_Font* font = nullptr;
+    std::array<Key, PIANO_KEY_NUM> keys;
+    Layout layout;
+    HitTable hitTable;
+    PointerTable pointers;
+    bool labelsDirty = false;
+    Uint32 resizeTime = 0;
+    PianoEngine* engine = nullptr;
+    Looper looper;
+    Arpeggiator arpeggiator;
+    ResourceWatcher watcher;
+    StressGenerator stress;
+    Options options;
+    Clock clock;
+    EventRecorder recorder;
+    EventReplay replay;
+    GoldenOutput golden;
+    Uint64 frameCount = 0;
+    Uint64 replayFrames = 0;
+    std::vector<Sint16> replayBuffer;
+    bool replayTail = false;
+    Uint64 replayTailFrom = 0;
+    Uint32 replayTailEnd = 0;
+    std::vector<Sint16> loopBus;
+
+    int audioFrequency = 0;
+    int audioChannelNum = 0;
+    int chunkSize = 0;
+    bool adaptiveBuffer = false;
+    Uint32 adaptWindowStart = 0;
+    Uint64 adaptMisses = 0;
+    int cleanWindows = 0;
+    int shrinkWindows = ADAPT_SHRINK_WINDOWS;
+
+    // SDL_mixer only drives the device, its channels stay silent and the engine renders everything.
+    static void music_hook(void* udata, Uint8* stream, int len) noexcept {
+        auto piano = static_cast<Piano*>(udata);
+        auto samples = reinterpret_cast<Sint16*>(stream);
+        int frameNum = len / (piano->audioChannelNum * static_cast<int>(sizeof(Sint16)));
+
+        // a device buffer fits the loop bus in one go, a larger one is rendered in pieces.
+        for (int done = 0; done < frameNum; done += MIXER_MAX_CHUNK_SIZE) {
+            int blockFrames = std::min(MIXER_MAX_CHUNK_SIZE, frameNum - done);
+            Sint16* buses[] = { samples + done * piano->audioChannelNum, piano->loopBus.data() };
+
+            piano->looper.schedule(piano->engine, blockFrames);
+            piano->arpeggiator.schedule(piano->engine, piano->looper, blockFrames);
+            piano_engine_process_buses(piano->engine, buses, 2, blockFrames);
+            piano->looper.mix(buses[0], buses[1], blockFrames);
+        }
+    }
+
+    void open_audio(int _chunkSize) {
+        if (Mix_OpenAudio(MIXER_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, MIXER_DEFAULT_CHANNEL_NUM, _chunkSize) < 0) {
+            throw std::runtime_error { "SDL_mixer could not initialize! SDL_mixer Error: "s + Mix_GetError() };
+        }
+
+        int frequency, channels;
+        Uint16 format;
+
+        if (Mix_QuerySpec(&frequency, &format, &channels) == 0) {
+            throw std::runtime_error { "Mix_QuerySpec() failed: "s + Mix_GetError() };
+        }
+
+        if (format != AUDIO_S16SYS) {
+            throw std::runtime_error { "audio output must be 16 bit, got format: "s + std::to_string(format) };
+        }
+
+        // the loaded sounds are in the device format, they must stay valid after a reopen.
+        if (audioChannelNum != 0 && (frequency != audioFrequency || channels != audioChannelNum)) {
+            throw std::runtime_error { "audio device changed its format on reopen." };
+        }
+
+        audioFrequency = frequency;
+        audioChannelNum = channels;
+        chunkSize = _chunkSize;
+
+        if (engine == nullptr) {
+            PianoEngineConfig config;
+            piano_engine_default_config(&config);
+            config.frequency = frequency;
+            config.channels = channels;
+            config.voiceNum = options.voices;
+
+            engine = piano_engine_create(&config);
+            if (engine == nullptr) {
+                throw std::runtime_error { "piano_engine_create() failed: "s + SDL_GetError() };
+            }
+        }
+
+        piano_engine_restart_timing(engine);
+    }
+
+    // the looper must be opened before the callback is attached.
+    void attach_audio() noexcept {
+        Mix_HookMusic(&Piano::music_hook, this);
+    }
+
+    void detach_audio() noexcept {
+        Mix_HookMusic(nullptr, nullptr);
+    }
+
+    Uint64 audio_misses() noexcept {
+        PianoEngineStats stats;
+        piano_engine_get_stats(engine, &stats, 0);
+        return stats.underruns + stats.overloads;
+    }
+
+    void log_stats() noexcept {
+        PianoEngineStats stats;
+        piano_engine_get_stats(engine, &stats, 1);
+        log_audio_stats("audio: ", stats, chunkSize);
+    }
+
+    void reopen_audio(int _chunkSize) {
+        int oldChunkSize = chunkSize;
+
+        // the watcher decodes with the device format, keep it from running while there is no device.
+        auto lock = watcher.lock_decoder();
+        detach_audio();
+        Mix_CloseAudio();
+        open_audio(_chunkSize);
+        attach_audio();
+        SDL_Log("audio buffer: %d -> %d frames\n", oldChunkSize, chunkSize);
+    }
+
+    void set_adaptive_buffer(bool on) noexcept {
+        adaptiveBuffer = on;
+        adaptWindowStart = clock.ticks();
+        adaptMisses = audio_misses();
+        cleanWindows = 0;
+        shrinkWindows = ADAPT_SHRINK_WINDOWS;
+        SDL_Log("adaptive audio buffer: %s\n", on ? "on" : "off");
+    }
+
+    // grows the buffer on any underrun or overload, shrinks it back after a clean stretch.
+    // each grow doubles the clean stretch needed, so it settles instead of flapping.
+    void adapt_buffer() {
+        Uint32 now = clock.ticks();
+
+        // the misses are timed on the wall clock, a replay keeps its buffer size to stay deterministic.
+        if (!adaptiveBuffer || clock.is_virtual() || now - adaptWindowStart < ADAPT_WINDOW_MILLISEC) {
+            return;
+        }
+
+        adaptWindowStart = now;
+        Uint64 misses = audio_misses();
+        bool clean = misses == adaptMisses;
+        adaptMisses = misses;
+
+        if (!clean) {
+            cleanWindows = 0;
+
+            if (chunkSize < MIXER_MAX_CHUNK_SIZE) {
+                reopen_audio(chunkSize * 2);
+                shrinkWindows = std::min(shrinkWindows * 2, ADAPT_MAX_SHRINK_WINDOWS);
+                adaptMisses = audio_misses();
+            }
+        }
+        else if (++cleanWindows >= shrinkWindows && chunkSize > MIXER_MIN_CHUNK_SIZE) {
+            cleanWindows = 0;
+            reopen_audio(chunkSize / 2);
+            adaptMisses = audio_misses();
+        }
+    }
+
+    void init_graphics_ttf_mixer(){
+        // a replay needs no screen nor speakers, and must not depend on them.
+        if (!options.replay.empty()) {
+            SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+            SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+        }
+
+        // let windows scale the window to the display, the drawable keeps the real pixel size.
+        SDL_SetHint(SDL_HINT_WINDOWS_DPI_SCALING, "1");
+
+        if (SDL_Init(SDL_INIT_VIDEO) < 0){
+            throw std::runtime_error { "SDL_Init() failed: "s + SDL_GetError() };
+        }
+
+        if (TTF_Init() == -1){
+            throw std::runtime_error { "SDL_ttf could not initialize! SDL_ttf Error: "s + TTF_GetError() };
+        }
+
+        open_audio(options.chunkSize);
+    }
+
+    void init_resources() {
+        window = SDL_CreateWindow(WINDOW_TITLE.c_str(), 
+								SDL_WINDOWPOS_CENTERED, 
+								SDL_WINDOWPOS_CENTERED, 
+								WINDOW_WIDTH, 
+								WINDOW_HEIGHT, 
+								SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+							
+	    if (window == nullptr){
+		    throw std::runtime_error { "create window failed: "s + SDL_GetError() };
+	    }
+
+        SDL_SetWindowMinimumSize(window, WINDOW_MIN_WIDTH, WINDOW_MIN_HEIGHT);
+
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+        if (renderer == nullptr){
+            throw std::runtime_error{ "create renderer failed: "s + SDL_GetError() };
+        }
+
+        font = TTF_OpenFont(FONT_PATH.c_str(), DEFAULT_FONT_SIZE);
+    	if (font == nullptr) {
+        	throw std::runtime_error{ "Failed to load font! SDL_ttf Error: "s + TTF_GetError() };
+    	}
+    }
+
+    void init_keys() noexcept {
+        for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+            const PianoKeyInfo* info = piano_key_info(i);
+            KeyType type = (info->keyType == PIANO_KEY_BLACK) ? KeyType::Black : KeyType::White;
+
+            keys[i] = Key{ type, info->keyName, info->toneName, info->initX };
+        }
+    }
+
+    Key* get_key_mapping(SDL_Keycode key) noexcept {
+        int index = piano_key_from_keycode(key);
+        return (index < 0) ? nullptr : &(keys[index]);
+    }
+
+    // sounds are decoded on first use, so the window shows up without waiting for all of them.
+    void load_sample(int index) {
+        if (piano_engine_sample_loaded(engine, index)) {
+            return;
+        }
+
+        if (!piano_engine_load_sample(engine, index, sound_path(index).c_str())) {
+            throw std::runtime_error { "Can't load sound resource: "s + sound_path(index) + ", error: "s + SDL_GetError() };
+        }
+    }
+
+    void play_key(Key* key) {
+        int index = static_cast<int>(key - keys.data());
+
+        // the arpeggiator plays the held keys on the audio thread, and records what it plays.
+        if (arpeggiator.is_on()) {
+            arpeggiator.key_down(index);
+            return;
+        }
+
+        load_sample(index);
+        piano_engine_note_on(engine, index);
+        looper.note_on(index);
+    }
+
+    void release_key(Key* key) noexcept {
+        key->release();
+
+        if (!key->is_pressed()) {
+            arpeggiator.key_up(static_cast<int>(key - keys.data()));
+            piano_engine_note_off(engine, static_cast<int>(key - keys.data()));
+        }
+    }
+
+    void load_all_samples() {
+        for (int i = 0; i < PIANO_KEY_NUM; ++i) {
+            load_sample(i);
+        }
+    }
+
+    void set_stress(bool on) {
+        if (on) {
+            load_all_samples();
+        }
+
+        stress.set_enabled(on, options.voices, clock.ticks());
+    }
+
+    // chords and arpeggios reach keys that were never pressed.
+    void next_arp_mode() {
+        load_all_samples();
+        arpeggiator.next_mode();
+    }
+
+    // the drawable may be larger than the window on HiDPI displays, keys are laid out in drawable pixels.
+    void update_layout() {
+        int width, height, windowWidth, windowHeight;
+
+        if (SDL_GetRendererOutputSize(renderer, &width, &height) == 0) {
+            SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+
+            layout.scaleX = static_cast<double>(width) / WINDOW_WIDTH;
+            layout.scaleY = static_cast<double>(height) / WINDOW_HEIGHT;
+            layout.width = width;
+            layout.height = height;
+            layout.pixelsPerPointX = static_cast<double>(width) / std::max(windowWidth, 1);
+            layout.pixelsPerPointY = static_cast<double>(height) / std::max(windowHeight, 1);
+        }
+
+        hitTable.build(keys, layout);
+    }
+
+    void pointer_down(Sint64 id, int x, int y) {
+        int key = hitTable.key_at(x, y);
+
+        // remember the pointer even off the keys, sliding onto a key plays it.
+        if (pointers.find(id) != nullptr || !pointers.insert(id, key)) {
+            return;
+        }
+
+        if (key >= 0) {
+            keys[key].press();
+            play_key(&(keys[key]));
+        }
+    }
+
+    // glissando, a pointer sliding to another key releases the old one and plays the new one.
+    void pointer_move(Sint64 id, int x, int y) {
+        int* held = pointers.find(id);
+        if (held == nullptr) {
+            return;
+        }
+
+        int key = hitTable.key_at(x, y);
+        if (key == *held) {
+            return;
+        }
+
+        if (*held >= 0) {
+            release_key(&(keys[*held]));
+        }
+
+        *held = key;
+
+        if (key >= 0) {
+            keys[key].press();
+            play_key(&(keys[key]));
+        }
+    }
+
+    void pointer_up(Sint64 id) noexcept {
+        int* held = pointers.find(id);
+        if (held == nullptr) {
+            return;
+        }
+
+        if (*held >= 0) {
+            release_key(&(keys[*held]));
+        }
+
+        pointers.erase(id);
+    }
+
+    int mouse_x(int x) const noexcept {
+        return static_cast<int>(x * layout.pixelsPerPointX);
+    }
+
+    int mouse_y(int y) const noexcept {
+        return static_cast<int>(y * layout.pixelsPerPointY);
+    }
+
+    int finger_x(float x) const noexcept {
+        return static_cast<int>(x * layout.width);
+    }
+
+    int finger_y(float y) const noexcept {
+        return static_cast<int>(y * layout.height);
+    }
+
+    // trackpads report finger events too, in trackpad coordinates, only touch screens point at keys.
+    // they are dropped as they come in, so a recording never holds them.
+    static bool is_indirect_touch(SDL_Event const& event) noexcept {
+        if (event.type != SDL_FINGERDOWN && event.type != SDL_FINGERMOTION && event.type != SDL_FINGERUP) {
+            return false;
+        }
+
+        return SDL_GetTouchDeviceType(event.tfinger.touchId) != SDL_TOUCH_DEVICE_DIRECT;
+    }
+
+    // the mouse events SDL makes up from touches are skipped, the fingers are handled directly.
+    void handle_pointer_event(SDL_Event const& event) {
+        switch (event.type) {
+            case SDL_MOUSEBUTTONDOWN:
+                if (event.button.which != SDL_TOUCH_MOUSEID && event.button.button == SDL_BUTTON_LEFT) {
+                    pointer_down(MOUSE_POINTER_ID, mouse_x(event.button.x), mouse_y(event.button.y));
+                }
+                break;
+            case SDL_MOUSEMOTION:
+                if (event.motion.which != SDL_TOUCH_MOUSEID && (event.motion.state & SDL_BUTTON_LMASK)) {
+                    pointer_move(MOUSE_POINTER_ID, mouse_x(event.motion.x), mouse_y(event.motion.y));
+                }
+                break;
+            case SDL_MOUSEBUTTONUP:
+                if (event.button.which != SDL_TOUCH_MOUSEID && event.button.button == SDL_BUTTON_LEFT) {
+                    pointer_up(MOUSE_POINTER_ID);
+                }
+                break;
+            case SDL_FINGERDOWN:
+                pointer_down(event.tfinger.fingerId, finger_x(event.tfinger.x), finger_y(event.tfinger.y));
+                break;
+            case SDL_FINGERMOTION:
+                pointer_move(event.tfinger.fingerId, finger_x(event.tfinger.x), finger_y(event.tfinger.y));
+                break;
+            case SDL_FINGERUP:
+                pointer_up(event.tfinger.fingerId);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void create_labels() {
+        if (TTF_SetFontSize(font, layout.font_size()) < 0) {
+            SDL_Log("TTF_SetFontSize() failed: %s\n", TTF_GetError());
+        }
+
+        for (auto& key : keys) {
+            key.create_labels(renderer, font);
+        }
+
+        labelsDirty = false;
+    }
+
+    // key geometry follows the window at once, the labels keep their old size until resizing pauses.
+    void handle_resize() {
+        update_layout();
+        labelsDirty = true;
+        resizeTime = clock.ticks();
+    }
+
+    void reload_font() {
+        TTF_Font* fresh = TTF_OpenFont(FONT_PATH.c_str(), layout.font_size());
+        if (fresh == nullptr) {
+            SDL_Log("Failed to reload font, keep the old one. SDL_ttf Error: %s\n", TTF_GetError());
+            return;
+        }
+
+        TTF_CloseFont(font);
+        font = fresh;
+        create_labels();
+        SDL_Log("reloaded font: %s\n", FONT_PATH.c_str());
+    }
+
+    void handle_control_key(SDL_Keycode key) {
+        switch (key) {
+            case SDLK_F1: looper.toggle_metronome(); break;
+            case SDLK_F2: looper.record(); break;
+            case SDLK_F3: looper.toggle_mute(0); break;
+            case SDLK_F4: looper.toggle_mute(1); break;
+            case SDLK_F5: looper.toggle_mute(2); break;
+            case SDLK_F6: looper.toggle_mute(3); break;
+            case SDLK_F7: looper.toggle_pcm_capture(); break;
+            case SDLK_F8: looper.clear(); break;
+            case SDLK_F9: log_stats(); break;
+            case SDLK_F10: set_adaptive_buffer(!adaptiveBuffer); break;
+            case SDLK_F11: set_stress(!stress.is_enabled()); break;
+            case SDLK_F12: next_arp_mode(); break;
+            case SDLK_TAB: arpeggiator.next_chord(); break;
+            case SDLK_UP: arpeggiator.set_gate(arpeggiator.get_gate() + ARP_PERCENT_STEP); break;
+            case SDLK_DOWN: arpeggiator.set_gate(arpeggiator.get_gate() - ARP_PERCENT_STEP); break;
+            case SDLK_RIGHT: arpeggiator.set_swing(arpeggiator.get_swing() + ARP_PERCENT_STEP); break;
+            case SDLK_LEFT: arpeggiator.set_swing(arpeggiator.get_swing() - ARP_PERCENT_STEP); break;
+            default: break;
+        }
+    }
+
+    void render() {
+        set_render_draw_color(renderer, COLOR_BLACK);
+        SDL_RenderClear(renderer);
+
+        // render white keys.
+        for (int i = 0; i < WHITE_KEY_NUM; ++i) {
+            keys[i].render(renderer, layout);
+        }
+
+        // render lines.
+        set_render_draw_color(renderer, COLOR_BLACK);
+        for (int i = 0; i < WHITE_KEY_NUM; ++i){
+            int x = layout.x(i * WHITE_KEY_WIDTH);
+            SDL_RenderDrawLine(renderer, x, 0, x, layout.y(WHITE_KEY_HEIGHT));
+        }
+
+        // render black keys.
+        for (int i = WHITE_KEY_NUM; i < PIANO_KEY_NUM; ++i){
+            keys[i].render(renderer, layout);
+        }
+
+        if (golden.is_open()) {
+            golden.frame_rendered(renderer, frameCount);
+        }
+
+        SDL_RenderPresent(renderer);
+    }
+
+    // a replay goes on after its last event until every note has rung out, or the tail is too long.
+    // at least one block is rendered first, so the notes of the last events have started.
+    bool replay_tail_done() noexcept {
+        if (!replayTail) {
+            replayTail = true;
+            replayTailFrom = replayFrames;
+            replayTailEnd = clock.ticks() + REPLAY_MAX_TAIL_MILLISEC;
+            return false;
+        }
+
+        PianoEngineStats stats;
+        piano_engine_get_stats(engine, &stats, 0);
+
+        return (replayFrames > replayTailFrom && stats.activeVoices == 0) || clock.ticks() >= replayTailEnd;
+    }
+
+    // a replay renders the audio on the frame loop, in device sized blocks, as far as the virtual clock got.
+    void render_replay_audio() {
+        Uint64 due = static_cast<Uint64>(clock.ticks()) * audioFrequency / 1000;
+        auto stream = reinterpret_cast<Uint8*>(replayBuffer.data());
+        int len = static_cast<int>(replayBuffer.size() * sizeof(Sint16));
+
+        while (replayFrames + chunkSize <= due) {
+            music_hook(this, stream, len);
+            replayFrames += chunkSize;
+
+            if (golden.is_open()) {
+                golden.add_audio(replayBuffer.data(), static_cast<int>(replayBuffer.size()));
+            }
+        }
+    }
+
+    // returns false on quit.
+    bool handle_event(SDL_Event const& event) {
+        if (event.type == SDL_QUIT) {
+            return false;
+        }
+
+        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            handle_resize();
+        }
+        else if (event.type == SDL_KEYDOWN) {
+            Key* key = get_key_mapping(event.key.keysym.sym);
+
+            if (key != nullptr) {
+                if (event.key.repeat == 0) {
+                    key->press();
+                }
+
+                play_key(key);
+            }
+            else if (event.key.repeat == 0) {
+                handle_control_key(event.key.keysym.sym);
+            }
+        }
+        else if (event.type == SDL_KEYUP) {
+            Key* key = get_key_mapping(event.key.keysym.sym);
+
+            if (key != nullptr) {
+                release_key(key);
+            }
+        }
+        else {
+            handle_pointer_event(event);
+        }
+
+        return true;
+    }
+
+    bool handle_replay_event(SDL_Event const& event) {
+        // the dummy window only changes size when told to.
+        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            SDL_SetWindowSize(window, event.window.data1, event.window.data2);
+        }
+
+        return handle_event(event);
+    }
+public:
+    Piano(Options const& _options)
+        : options{ _options }
+    {}
+
+    ~Piano() noexcept {
+        watcher.stop();
+
+        for (auto& key : keys) {
+            key.free_labels();
+        }
+
+        if (font != nullptr) {
+            TTF_CloseFont(font);
+        }
+
+        if (renderer != nullptr) {
+		    SDL_DestroyRenderer(renderer);
+	    }
+	
+	    if (window != nullptr) {
+		    SDL_DestroyWindow(window);
+	    }
+
+        if (audioChannelNum != 0) {
+            detach_audio();
+        }
+
+        Mix_CloseAudio();
+        piano_engine_destroy(engine);
+        Mix_Quit();
+        TTF_Quit();
+        SDL_Quit();        
+    }
+
+    // returns false when a replay doesn't match its golden output.
+    bool start() {
+        bool replaying = !options.replay.empty();
+
+        if (replaying) {
+            replay.load(options.replay);
+            clock.make_virtual();
+        }
+
+        if (!options.record.empty()) {
+            recorder.open(options.record);
+        }
+
+        init_graphics_ttf_mixer();
+        init_resources();
+        init_keys();
+        update_layout();
+        create_labels();
+        looper.open(audioFrequency, audioChannelNum, options.bpm, options.loopBars);
+        loopBus.resize(static_cast<std::size_t>(MIXER_MAX_CHUNK_SIZE) * audioChannelNum);
+
+        if (replaying) {
+            replayBuffer.resize(static_cast<std::size_t>(chunkSize) * audioChannelNum);
+
+            if (!options.golden.empty()) {
+                golden.open(options, audioFrequency, audioChannelNum);
+            }
+        }
+        else {
+            attach_audio();
+            watcher.start(engine);
+        }
+
+        stress.configure(options.stressRate, options.stressChord);
+        arpeggiator.configure(options.arpMode, options.chord, options.gate, options.swing);
+
+        if (arpeggiator.is_on()) {
+            load_all_samples();
+        }
+
+        if (options.adaptiveBuffer) {
+            set_adaptive_buffer(true);
+        }
+
+        if (options.stress) {
+            set_stress(true);
+        }
+
+        Uint32 startTime, endTime, frameTime;
+        bool running = true;
+        SDL_Event event;
+
+        while (running) {
+		startTime = clock.ticks();
+
+		if (replaying) {
+			// only the recorded input counts, whatever the dummy drivers report.
+			SDL_PumpEvents();
+			SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+
+			replay.for_frame(frameCount, [&](SDL_Event const& recorded) {
+				running = handle_replay_event(recorded) && running;
+			});
+		}
+		else {
+			while (SDL_PollEvent(&event)) {
+				if (is_indirect_touch(event)) {
+					continue;
+				}
+
+				recorder.record(frameCount, event);
+				running = handle_event(event) && running;
+			}
+		}
+
+		if (watcher.take_font_change()) {
+			reload_font();
+		}
+
+		if (labelsDirty && clock.ticks() - resizeTime >= RELAYOUT_DEBOUNCE_MILLISEC) {
+			create_labels();
+		}
+
+		stress.step(engine, chunkSize, clock.ticks());
+		adapt_buffer();
+		piano_engine_collect(engine);
+		looper.report_changes();
+
+		if (replaying) {
+			render_replay_audio();
+
+			if (replay.finished() && replay_tail_done()) {
+				running = false;
+			}
+		}
+
+		render();
+		++frameCount;
+
+            	endTime = clock.ticks();
+            	frameTime = endTime - startTime;
+
+            	if (frameTime < FRAME_DELAY_MILLISEC) {
+                	clock.delay(FRAME_DELAY_MILLISEC - frameTime);
+            	}
+	}
+
+        log_stats();
+        return golden.is_open() ? golden.finish() : true;
     }
 };
 
-int main(){
+int main(int argc, char* argv[]){
     try {
-        auto piano = std::make_unique<Piano>();
-        piano->start();
+        auto piano = std::make_unique<Piano>(parse_options(argc, argv));
+        return piano->start() ? 0 : 1;
     }
     catch(std::exception const& e){
         std::cerr << e.what() << "\n";
     }
     
-    return 0;
+    return 1;
 }
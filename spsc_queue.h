@@ -0,0 +1,43 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// single producer, single consumer ring buffer, lets a control thread hand commands
+// to the audio thread without a lock. N must be a power of 2.
+template <typename T, std::size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of 2.");
+
+    std::array<T, N> buffer;
+    std::atomic<std::size_t> head{ 0 };
+    std::atomic<std::size_t> tail{ 0 };
+public:
+    bool push(T const& item) noexcept {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+
+        if (t - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+
+        buffer[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) noexcept {
+        std::size_t h = head.load(std::memory_order_relaxed);
+
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = buffer[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif